@@ -2,6 +2,10 @@
 
 #include "MyProject.hpp"
 
+// Uncomment to time, at startup, the creation and update of 10k descriptor
+// sets with vkUpdateDescriptorSets and with the update templates
+//#define DESCRIPTOR_UPDATE_BENCHMARK
+
 //const std::string MODEL_PATH = "Assets/models/Boat.obj";
 //const std::string TEXTURE_PATH = "Assets/textures/Boat.bmp";
 
@@ -13,28 +17,88 @@ enum Level {l0, l1, l2, l3, l4, l5, l6, l7, l8, l9};
 struct GlobalUniformBufferObject {
 	alignas(16) glm::mat4 view;
 	alignas(16) glm::mat4 proj;
+
+	bool operator==(const GlobalUniformBufferObject &o) const {
+		return view == o.view && proj == o.proj;
+	}
+};
+
+// The per-draw data, recorded with vkCmdPushConstants
+struct PushConstantObject {
+	alignas(16) glm::mat4 model;
+	uint32_t texIndex;	// slot in the bindless texture table
 };
 
-struct UniformBufferObject {
+// The per-instance data, read by the instanced pipeline from a storage buffer
+struct InstanceObject {
 	alignas(16) glm::mat4 model;
+	uint32_t texIndex;	// slot in the bindless texture table
+};
+
+// The game is simulated at a fixed rate, on its own thread
+const float SIM_STEP = 1.f / 120.f;
+
+// Far plane of the camera: nothing further away is drawn
+const float FAR_PLANE = 100.0f;
+
+// The keys read by the game, sampled by the render thread (GLFW can be
+// queried only there) and passed to the simulation as a bit mask
+enum InputKey {
+	INPUT_PLAY = 1 << 0,
+	INPUT_RIGHT = 1 << 1,
+	INPUT_LEFT = 1 << 2,
+	INPUT_LEVEL_0 = 1 << 3		// INPUT_LEVEL_0 << n for the key n
+};
+
+// The moving part of the game, owned by the simulation thread
+struct SimState {
+	glm::vec3 boatPos = glm::vec3(0.f, 0.f, 0.f);
+	float boatAngle = 0.f;
+	std::vector<glm::vec3> rockPos;
+	std::vector<float> landscapePosX;
+};
+
+// What the render thread needs to draw a frame: the last two steps, to
+// interpolate between them, and the time the last one was published
+struct SimSnapshot {
+	SimState current;
+	SimState previous;
+	int state;
+	int levelLabel;
+	float distanceFinishLine;
+	float posCameraY;
+	std::chrono::steady_clock::time_point stepTime;
+};
+
+// An object drawn with its own draw call
+struct VisibleObject {
+	Model* model;
+	DescriptorSet* ds;
+	PushConstantObject* pc;
+};
+
+// A draw of the draw list, before culling: slot is its instance in DSinst
+struct DrawCandidate {
+	Model* model;
+	DescriptorSet* ds;
+	uint32_t slot;
 };
 
 struct RockObject {
-	DescriptorSet ds;
-	glm::vec3 currentPos;
+	Tracked<glm::mat4> transform;
 };
 
 struct BoatObject {
 	Model model;
 	Texture texture;
 	DescriptorSet ds;
-	glm::vec3 currentPos = glm::vec3(0.f, 0.f, 0.f);
+	PushConstantObject pc;
+	glm::vec3 renderPos = glm::vec3(0.f, 0.f, 0.f);
 };
 
+// Grass and water tiles share the same transform
 struct LandscapeObject {
-	DescriptorSet grassDs;
-	DescriptorSet waterDs;
-	float currentPosX = -15.f;
+	Tracked<glm::mat4> transform;
 };
 
 struct DataPersonalization{
@@ -64,21 +128,26 @@ class MyProject : public BaseProject {
 	// Descriptor Layouts [what will be passed to the shaders]
 	DescriptorSetLayout DSLglobal;
 	DescriptorSetLayout DSLobj;
+	DescriptorSetLayout DSLinst;
 
 	// Pipelines [Shader couples]
 	Pipeline P1;
+	Pipeline P2;
 
 	// Models, textures and Descriptors (values assigned to the uniforms)
 	BoatObject boatObject;
 
 	Model GrassModel;
 	Texture GrassTexture;
+	DescriptorSet GrassDS;
 
 	Model WaterModel;
 	Texture WaterTexture;
+	DescriptorSet WaterDS;
 
 	Model Rock1Model;
 	Texture Rock1Texture;
+	DescriptorSet Rock1DS;
 	std::vector<RockObject> rockObjects;
 
 	std::vector<LandscapeObject> landscapeObjects;
@@ -86,46 +155,74 @@ class MyProject : public BaseProject {
 	Model finishLineModel;
 	Texture finishLineTexture;
 	DescriptorSet finishLineDS;
+	PushConstantObject finishLinePC;
+
+	// The pages and the HUD, drawn as sprites in the overlay pass
+	SpriteBatch hud;
+	static const uint32_t MAX_HUD_SPRITES = 512;
 
-	Model welcomeModel;
 	Texture welcomeTexture;
 	DescriptorSet welcomeDS;
 
-	Model lostPageModel;
 	Texture lostPageTexture;
 	DescriptorSet lostPageDS;
 
-	Model wonPageModel;
 	Texture wonPageTexture;
 	DescriptorSet wonPageDS;
 
-	Model infoModel;
 	Texture infoTexture;
 	DescriptorSet infoDS;
 
-	Model l1Model;
-	Texture l0Texture;
-	DescriptorSet l0DS;
-	Texture l1Texture;
-	DescriptorSet l1DS;
-	Texture l2Texture;
-	DescriptorSet l2DS;
-	Texture l3Texture;
-	DescriptorSet l3DS;
-	Texture l4Texture;
-	DescriptorSet l4DS;
-	Texture l5Texture;
-	DescriptorSet l5DS;
-	Texture l6Texture;
-	DescriptorSet l6DS;
-	Texture l7Texture;
-	DescriptorSet l7DS;
-	Texture l8Texture;
-	DescriptorSet l8DS;
-	Texture l9Texture;
-	DescriptorSet l9DS;
+	// The text of the HUD: laid out again only when it changes
+	Font font;
+	TextLayout levelText;
+	TextLayout distanceText;
+	TextLayout speedText;
+	TextLayout fpsText;
+	float fpsAverage = 0.f;
 
 	DescriptorSet DSglobal;
+	Tracked<GlobalUniformBufferObject> globalUBO;
+
+	// Instances of the grass tiles, then of the water tiles, then of the rocks
+	DescriptorSet DSinst;
+
+	// The simulation thread advances sim (keeping the previous step in
+	// simPrevious) and publishes it in snapshots; the globals level, state,
+	// levelLabel and firstTime belong to it too
+	std::thread simThread;
+	std::atomic<bool> simRunning{false};
+	std::atomic<uint32_t> inputKeys{0};
+	uint32_t simInput = 0;
+	SimState sim;
+	SimState simPrevious;
+	TripleBuffer<SimSnapshot> snapshots;
+
+	// The game state of the last frame drawn
+	int renderedState = -1;
+
+	// The objects drawn one by one in this frame: the others cost nothing.
+	// With the bindless table they are instances of P2 too, in the
+	// last MAX_VISIBLE_OBJECTS slots of DSinst
+	std::vector<VisibleObject> visibleObjects;
+	static const uint32_t MAX_VISIBLE_OBJECTS = 16;
+
+	// One indirect command per tile, rock and (with bindless) visible object
+	// in the view: culled here, or by the GPU when possible
+	DrawList drawList;
+	std::vector<DrawCandidate> drawCandidates;
+	FrustumCuller culler;
+
+	// The draws of the frame, sorted by state
+	RenderQueue renderQueue;
+	static const uint32_t ITEMS_PER_JOB = 4;
+
+	public:
+	~MyProject() {
+		stopSimulation();
+	}
+
+	protected:
 	
 	// Here you set the main application parameters
 	void setWindowParameters() {
@@ -134,11 +231,12 @@ class MyProject : public BaseProject {
 		windowHeight = 792;
 		windowTitle = "My Project";
 		initialBackgroundColor = {0.f, 0.f, 0.f, 1.f};
-		
-		// Descriptor pool sizes
-		uniformBlocksInPool = 15 + level.maxNumberRock + level.maxNumberLandscape * 2 +1 +1;
-		texturesInPool = 14 + level.maxNumberRock + level.maxNumberLandscape * 2 +1 +1;
-		setsInPool = 15 + level.maxNumberRock + level.maxNumberLandscape * 2 +1 +1;
+
+		// the menus are drawn only when something changes, the game
+		// at most at this rate
+		frameRateCap = 144.f;
+
+		// Descriptor pools are created on demand by BaseProject::descriptorAllocator
 
 		std::srand(std::time(nullptr));
 	}
@@ -151,141 +249,85 @@ class MyProject : public BaseProject {
 					// first  element : the binding number
 					// second element : the time of element (buffer or texture)
 					// third  element : the pipeline stage where it will be used
-					{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT},
+					// (the model matrix is a push constant, see PushConstantObject)
 					{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
 				  });
 
 		DSLglobal.init(this, {
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}
+			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			 VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT}
 			});
 
+		// also read by the culling shader of the draw list
+		DSLinst.init(this, {
+			{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT}
+			});
+
+		// Set 1 holds the textures: the whole bindless table when supported,
+		// otherwise the set of the texture of each draw
+		DescriptorSetLayout* DSLtex = bindlessSupported ? &bindlessDSL : &DSLobj;
+		std::string fragShader = bindlessSupported ? "shaders/fragBindless.spv" : "shaders/frag.spv";
+
 		// Pipelines [Shader couples]
 		// The last array, is a vector of pointer to the layouts of the sets that will
 		// be used in this pipeline. The first element will be set 0, and so on..
-		P1.init(this, "shaders/vert.spv", "shaders/frag.spv", {&DSLglobal, &DSLobj});
+		// The optional last array lists the push constant ranges of the pipeline.
+		P1.init(this, "shaders/vertPC.spv", fragShader, {&DSLglobal, DSLtex},
+				{{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstantObject)}});
+		// Instanced pipeline: the model matrix is taken from DSinst with gl_InstanceIndex
+		P2.init(this, "shaders/vertInst.spv", fragShader, {&DSLglobal, DSLtex, &DSLinst});
 
 		// Models, textures and Descriptors (values assigned to the uniforms)
 
 		/* INITIALIZATING THE BOAT MODEL AND TEXTURE */
 		boatObject.model.init(this, "models/Boat.obj");
 		boatObject.texture.init(this, "textures/Boat.bmp");
+		boatObject.pc.texIndex = boatObject.texture.textureIndex;
 		boatObject.ds.init(this, &DSLobj, {
-					{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
 					{1, TEXTURE, 0, &boatObject.texture}
 		});
 
 		/*--------------------------------------------------*/
 
-		/* INITIALIZETING THE WELCOME PAGE MODEL AND TEXTURE */
-		welcomeModel.init(this, "models/Square.obj");
+		/* INITIALIZING THE SPRITES OF THE PAGES AND OF THE HUD */
+		hud.init(this, MAX_HUD_SPRITES, "shaders/vertSprite.spv", "shaders/fragSprite.spv", &DSLobj);
+
 		welcomeTexture.init(this, "textures/CGWelcome.png");
 		welcomeDS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
 						{1, TEXTURE, 0, &welcomeTexture}
 			});
 
-		/*----------------------------------------------------*/
-
-		/* INITIALIZETING THE LOST PAGE MODEL AND TEXTURE*/
-
-		lostPageModel.init(this, "models/Square.obj");
 		lostPageTexture.init(this, "textures/CGYouLost.png");
 		lostPageDS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
 						{1, TEXTURE, 0, &lostPageTexture}
 			});
 
-		/*-----------------------------------------------*/
-
-		/* INITIALIZETING THE WON PAGE MODEL AND TEXTURE*/
-
-		wonPageModel.init(this, "models/Square.obj");
 		wonPageTexture.init(this, "textures/CGYouWon.png");
 		wonPageDS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
 						{1, TEXTURE, 0, &wonPageTexture}
 			});
 
-		/*-----------------------------------------------*/
-
-		/* INITIALIZETING THE INFO MODEL AND TEXTURE*/
-
-		infoModel.init(this, "models/Square.obj");
 		infoTexture.init(this, "textures/CGInfo.png");
 		infoDS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
 						{1, TEXTURE, 0, &infoTexture}
 			});
 
-		/*-----------------------------------------------*/
-
-		/* INITIALIZETING THE LEVEL MODEL AND LEVEL'S TEXTURES*/
-
-		l1Model.init(this, "models/Square.obj");
-		l0Texture.init(this, "textures/CGL0.png");
-		l0DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l0Texture}
-			});
-		l1Texture.init(this, "textures/CGL1.png");
-		l1DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l1Texture}
-			});
-		l2Texture.init(this, "textures/CGL2.png");
-		l2DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l2Texture}
-			});
-		l3Texture.init(this, "textures/CGL3.png");
-		l3DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l3Texture}
-			});
-		l4Texture.init(this, "textures/CGL4.png");
-		l4DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l4Texture}
-			});
-		l5Texture.init(this, "textures/CGL5.png");
-		l5DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l5Texture}
-			});
-		l6Texture.init(this, "textures/CGL6.png");
-		l6DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l6Texture}
-			});
-		l7Texture.init(this, "textures/CGL7.png");
-		l7DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l7Texture}
-			});
-		l8Texture.init(this, "textures/CGL8.png");
-		l8DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l8Texture}
-			});
-		l9Texture.init(this, "textures/CGL9.png");
-		l9DS.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &l9Texture}
-			});
+		font.init(this, &DSLobj);
 
 		/*-----------------------------------------------*/
 
 		/* INITIALIZATING THE FINISH LINE MODEL AND TEXXTURE*/
 		finishLineModel.init(this, "models/FinishLine1.obj");
 		finishLineTexture.init(this, "textures/FinishLine.png");
+		finishLinePC.texIndex = finishLineTexture.textureIndex;
 		finishLineDS.init(this, &DSLobj, {
 			// the second parameter, is a pointer to the Uniform Set Layout of this set
 			// the last parameter is an array, with one element per binding of the set.
 			// first  elmenet : the binding number
-			// second element : UNIFORM or TEXTURE (an enum) depending on the type
-			// third  element : only for UNIFORMs, the size of the corresponding C++ object
+			// second element : UNIFORM, TEXTURE or STORAGE (an enum) depending on the type
+			// third  element : only for UNIFORMs and STORAGEs, the size of the corresponding C++ object
 			// fourth element : only for TEXTUREs, the pointer to the corresponding texture object
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
 						{1, TEXTURE, 0, &finishLineTexture}
 			});
 		/*---------------------------------------------------*/
@@ -294,21 +336,17 @@ class MyProject : public BaseProject {
 		/* INITIALIZING MODEL AND TEXTURE OF GRASS AND WATER + INITIALIZING THE DESCRIPTIVE SET AND POSITION */
 		WaterModel.init(this, "models/Water.obj");
 		WaterTexture.init(this, "textures/Water.png");
+		WaterDS.init(this, &DSLobj, {
+					{1, TEXTURE, 0, &WaterTexture}
+			});
 		GrassModel.init(this, "models/Grass.obj");
 		GrassTexture.init(this, "textures/Grass.png");
+		GrassDS.init(this, &DSLobj, {
+					{1, TEXTURE, 0, &GrassTexture}
+			});
 		landscapeObjects.resize(level.maxNumberLandscape);
-		float i = 10.f;
 		for (auto& obj : landscapeObjects) {
-			obj.waterDs.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &WaterTexture}
-				});
-			obj.grassDs.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &GrassTexture}
-				});
-			//obj.currentPosX += i;
-			//i += 10.f;
+			obj.transform.init(MAX_FRAMES_IN_FLIGHT);
 		}
 		
 		/*-------------------------------------------------------------------*/
@@ -317,495 +355,400 @@ class MyProject : public BaseProject {
 		/* INITIALIZING MODEL AND TEXTURE OF ROCK1 + INITIALIZING THE DESCRIPTIVE SET */
 		Rock1Model.init(this, "models/Rock1.obj");
 		Rock1Texture.init(this, "textures/Rock1.png");
+		Rock1DS.init(this, &DSLobj, {
+					{1, TEXTURE, 0, &Rock1Texture}
+			});
 		rockObjects.resize(level.maxNumberRock);
-		i = 15.f;
-		int even = 1;
-		for (auto &obj : rockObjects) {
-			obj.ds.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &Rock1Texture}
-				});
-
-			/* INITIALIZING THE POSITION OF THE ROCKS */
-			//obj.currentPos = glm::vec3(-20.f, 0.f, 0.f);
-			/*obj.currentPos = glm::vec3(i, 0.f, (std::rand()%5 -2)*level.distanceBetweenRocksZ);
-			if ((even % level.numberRocksLine) == 0) {
-				i += level.distanceBetweenRocksX;
-			}
-			even++;*/
+		for (auto& obj : rockObjects) {
+			obj.transform.init(MAX_FRAMES_IN_FLIGHT);
 		}
 
 		/*-----------------------------------------------------*/
 
+		/* INITIALIZING THE INSTANCE BUFFER OF GRASS, WATER, ROCKS AND VISIBLE OBJECTS */
+		DSinst.init(this, &DSLinst, {
+					{0, STORAGE, static_cast<int>(sizeof(InstanceObject) * instanceCount()), nullptr}
+			});
+		drawList.init(this, instanceCount(), 16);
+		drawList.enableCulling("shaders/cull.spv", {&DSLglobal, &DSLinst});
+		renderQueue.init(this);
+
+		/*-----------------------------------------------------*/
+
 		/*Descriptor set global*/
 		DSglobal.init(this, &DSLglobal, {
 						{0, UNIFORM, sizeof(GlobalUniformBufferObject), nullptr}
 		});
+		globalUBO.init(MAX_FRAMES_IN_FLIGHT);
+
+#ifdef DESCRIPTOR_UPDATE_BENCHMARK
+		DSglobal.benchmarkUpdates(10000);			// one uniform buffer
+		boatObject.ds.benchmarkUpdates(10000);		// one texture
+#endif
+
+		/* STARTING THE SIMULATION THREAD */
+		sim.rockPos.assign(rockObjects.size(), glm::vec3(0.f, 0.f, 0.f));
+		sim.landscapePosX.assign(landscapeObjects.size(), -15.f);
+		simPrevious = sim;
+		publishSnapshot();
+		snapshots.update();
+
+		simRunning = true;
+		simThread = std::thread(&MyProject::simulationLoop, this);
 	}
 
 	// Here you destroy all the objects you created!		
 	void localCleanup() {
+		stopSimulation();
+		drawList.cleanup();
+
 		boatObject.ds.cleanup();
 		boatObject.texture.cleanup();
 		boatObject.model.cleanup();
 
-		for (auto &obj : rockObjects) {
-			obj.ds.cleanup();
-		}
-
-		for (auto& obj : landscapeObjects) {
-			obj.grassDs.cleanup();
-			obj.waterDs.cleanup();
-		}
-
 		finishLineDS.cleanup();
 		finishLineTexture.cleanup();
 		finishLineModel.cleanup();
 
+		hud.cleanup();
+
 		welcomeDS.cleanup();
 		welcomeTexture.cleanup();
-		welcomeModel.cleanup();
 
 		lostPageDS.cleanup();
 		lostPageTexture.cleanup();
-		lostPageModel.cleanup();
 
 		wonPageDS.cleanup();
 		wonPageTexture.cleanup();
-		wonPageModel.cleanup();
 
 		infoDS.cleanup();
 		infoTexture.cleanup();
-		infoModel.cleanup();
-
-		l0DS.cleanup();
-		l0Texture.cleanup();
-		l1DS.cleanup();
-		l1Texture.cleanup();
-		l2DS.cleanup();
-		l2Texture.cleanup();
-		l3DS.cleanup();
-		l3Texture.cleanup();
-		l4DS.cleanup();
-		l4Texture.cleanup();
-		l5DS.cleanup();
-		l5Texture.cleanup();
-		l6DS.cleanup();
-		l6Texture.cleanup();
-		l7DS.cleanup();
-		l7Texture.cleanup();
-		l8DS.cleanup();
-		l8Texture.cleanup();
-		l9DS.cleanup();
-		l9Texture.cleanup();
-		l1Model.cleanup();
 
+		font.cleanup();
 
+		WaterDS.cleanup();
 		WaterTexture.cleanup();
 		WaterModel.cleanup();
 
+		Rock1DS.cleanup();
 		Rock1Texture.cleanup();
 		Rock1Model.cleanup();
 
+		GrassDS.cleanup();
 		GrassTexture.cleanup();
 		GrassModel.cleanup();
 
 		DSglobal.cleanup();
+		DSinst.cleanup();
 
 		P1.cleanup();
+		P2.cleanup();
 		DSLglobal.cleanup();
 		DSLobj.cleanup();
+		DSLinst.cleanup();
 	}
 	
 	// Here it is the creation of the command buffer:
 	// You send to the GPU all the objects you want to draw,
 	// with their buffers and textures
-	void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
-				
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, P1.graphicsPipeline);
-				
-		//Binding the global descriptor set
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 0, 1, &DSglobal.descriptorSets[currentImage],
-			0, nullptr);
+	// The draws are culled on the GPU against the camera of DSglobal,
+	// with the model matrices of DSinst
+	void recordBeforeRenderPass(VkCommandBuffer commandBuffer, int currentImage) {
+		drawList.recordCulling(commandBuffer, currentImage,
+			{DSglobal.descriptorSets[currentImage], DSinst.descriptorSets[currentImage]});
+	}
 
-		/*
-		* Creating the buffer and the command for the boat
-		*/
-		VkBuffer vertexBuffers[] = { boatObject.model.vertexBuffer};
-		// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
-		VkDeviceSize offsets[] = {0};
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, boatObject.model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-						VK_PIPELINE_BIND_POINT_GRAPHICS,
-						P1.pipelineLayout, 1, 1, &boatObject.ds.descriptorSets[currentImage],
-						0, nullptr);
-						
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(boatObject.model.indices.size()), 1, 0, 0, 0);
-
-
-		/* CREATING BUFFER FOR FINISH LINE */
-		VkBuffer vertexBuffers1[] = { finishLineModel.vertexBuffer };
-		// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
-		VkDeviceSize offsets1[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers1, offsets1);
-		vkCmdBindIndexBuffer(commandBuffer, finishLineModel.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &finishLineDS.descriptorSets[currentImage],
-			0, nullptr);
+	// The pages and the HUD, over the upscaled frame
+	void recordOverlay(VkCommandBuffer commandBuffer, int currentImage) {
+		hud.record(commandBuffer, currentImage);
+	}
+
+	// The render queue is split in jobs of ITEMS_PER_JOB draws. Recording
+	// inline, a single job keeps the bound state across the whole queue.
+	uint32_t itemsPerJob() {
+		return recordWorkers.threads.empty() ?
+			std::max<uint32_t>(1, static_cast<uint32_t>(renderQueue.items.size())) : ITEMS_PER_JOB;
+	}
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(finishLineModel.indices.size()), 1, 0, 0, 0);
+	uint32_t recordJobCount() {
+		return (static_cast<uint32_t>(renderQueue.items.size()) + itemsPerJob() - 1) / itemsPerJob();
+	}
 
-		/*-----------------------------------------------------------*/
+	void recordJob(uint32_t job, VkCommandBuffer commandBuffer, int currentImage) {
+		size_t first = job * itemsPerJob();
+		size_t count = std::min<size_t>(itemsPerJob(), renderQueue.items.size() - first);
+
+		renderQueue.flush(commandBuffer, first, count,
+			[this, currentImage](VkCommandBuffer cb, Pipeline& P) {
+				return bindPipelineSets(cb, P, currentImage);
+			},
+			[this, currentImage](VkCommandBuffer cb, Pipeline& P, DescriptorSet& DS) {
+				return bindTextureSet(cb, P, DS, currentImage);
+			},
+			[this, currentImage](VkCommandBuffer cb, const RenderQueue::Item& item) {
+				if (item.pipeline == &P2) {
+					/* INSTANCED OBJECTS: one indirect call per mesh */
+					drawList.record(cb, currentImage, item.payload);
+				} else {
+					/* THE VISIBLE OBJECTS, with their push constants */
+					const VisibleObject& obj = visibleObjects[item.payload];
+					vkCmdPushConstants(cb, P1.pipelineLayout,
+						VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstantObject), obj.pc);
+					vkCmdDrawIndexed(cb, static_cast<uint32_t>(obj.model->indices.size()), 1, 0, 0, 0);
+					drawCalls++;
+				}
+			});
+	}
 
-		/* CREATING BUFFER FOR THE WELCOME */
+	// Set 0 is the global set, set 2 the model matrices of the instances.
+	// Returns the number of sets bound, for the counters of the queue
+	uint32_t bindPipelineSets(VkCommandBuffer commandBuffer, Pipeline& P, int currentImage) {
+		uint32_t binds = 1;
 
-		VkBuffer vertexBuffers2[] = { welcomeModel.vertexBuffer };
-		// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
-		VkDeviceSize offsets2[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers2, offsets2);
-		vkCmdBindIndexBuffer(commandBuffer, welcomeModel.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 		vkCmdBindDescriptorSets(commandBuffer,
 			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &welcomeDS.descriptorSets[currentImage],
+			P.pipelineLayout, 0, 1, &DSglobal.descriptorSets[currentImage],
 			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(welcomeModel.indices.size()), 1, 0, 0, 0);
-
-		/*-----------------------------------------------------------*/
-
-
-		/* Creating the buffer and the Command for the RIVER*/
-
-		VkBuffer vertexBuffers3[] = { GrassModel.vertexBuffer };
-		VkDeviceSize offsets3[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers3, offsets3);
-		vkCmdBindIndexBuffer(commandBuffer, GrassModel.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-		for (auto& obj : landscapeObjects) {
-
+		if (&P == &P2) {
 			vkCmdBindDescriptorSets(commandBuffer,
 				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				P1.pipelineLayout, 1, 1, &obj.grassDs.descriptorSets[currentImage],
+				P2.pipelineLayout, 2, 1, &DSinst.descriptorSets[currentImage],
 				0, nullptr);
-
-			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(GrassModel.indices.size()), 1, 0, 0, 0);
-
+			binds++;
 		}
+		binds += bindTextureTable(commandBuffer, P);
 
-		/*-----------------------------------------------------------*/
-
-		/* CREATING THE BUFFER AND COMMAND FOR THE WATER */
-
-		VkBuffer vertexBuffers4[] = { WaterModel.vertexBuffer };
-		VkDeviceSize offsets4[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers4, offsets4);
-		vkCmdBindIndexBuffer(commandBuffer, WaterModel.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-		for (auto& obj : landscapeObjects) {
-
-			vkCmdBindDescriptorSets(commandBuffer,
-				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				P1.pipelineLayout, 1, 1, &obj.waterDs.descriptorSets[currentImage],
-				0, nullptr);
-
-			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(WaterModel.indices.size()), 1, 0, 0, 0);
+		return binds;
+	}
 
+	void addVisible(Model& model, DescriptorSet& ds, PushConstantObject& pc) {
+		if (visibleObjects.size() < MAX_VISIBLE_OBJECTS) {
+			visibleObjects.push_back({ &model, &ds, &pc });
 		}
-		/*-----------------------------------------------------------*/
-
-
-		/* CREATING THE BUFFER AND THE COMMAND FOR THE ROCKS */
-
-		VkBuffer vertexBuffers5[] = { Rock1Model.vertexBuffer };
-		VkDeviceSize offsets5[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers5, offsets5);
-		vkCmdBindIndexBuffer(commandBuffer, Rock1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-		for (auto& obj : rockObjects) {
-
-			vkCmdBindDescriptorSets(commandBuffer,
-				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				P1.pipelineLayout, 1, 1, &obj.ds.descriptorSets[currentImage],
-				0, nullptr);
+	}
 
-			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(Rock1Model.indices.size()), 1, 0, 0, 0);
+	// With the bindless table, set 1 is bound once and the draws select
+	// their texture with texIndex
+	uint32_t bindTextureTable(VkCommandBuffer commandBuffer, Pipeline& P) {
+		if (!bindlessSupported) {
+			return 0;
 		}
-
-		/*---------------------------------------------------*/
-
-		/* CREATING THE BUFFER FOR THE LOST PAGE */
-		VkBuffer vertexBuffers6[] = { lostPageModel.vertexBuffer };
-		VkDeviceSize offsets6[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers6, offsets6);
-		vkCmdBindIndexBuffer(commandBuffer, lostPageModel.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 		vkCmdBindDescriptorSets(commandBuffer,
 			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &lostPageDS.descriptorSets[currentImage],
+			P.pipelineLayout, 1, 1, &bindlessSet,
 			0, nullptr);
+		return 1;
+	}
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(lostPageModel.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
-
-		/* CREATING THE BUFFER FOR THE WON PAGE */
-		VkBuffer vertexBuffers7[] = { wonPageModel.vertexBuffer };
-		VkDeviceSize offsets7[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers7, offsets7);
-		vkCmdBindIndexBuffer(commandBuffer, wonPageModel.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	// Without it, the set of the texture is bound before each draw
+	uint32_t bindTextureSet(VkCommandBuffer commandBuffer, Pipeline& P, DescriptorSet& DS, int currentImage) {
+		if (bindlessSupported) {
+			return 0;
+		}
 		vkCmdBindDescriptorSets(commandBuffer,
 			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &wonPageDS.descriptorSets[currentImage],
+			P.pipelineLayout, 1, 1, &DS.descriptorSets[currentImage],
 			0, nullptr);
+		return 1;
+	}
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(wonPageModel.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
-
-		/* CREATING THE BUFFER FOR THE INFO */
-		VkBuffer vertexBuffers18[] = { infoModel.vertexBuffer };
-		VkDeviceSize offsets18[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers18, offsets18);
-		vkCmdBindIndexBuffer(commandBuffer, infoModel.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &infoDS.descriptorSets[currentImage],
-			0, nullptr);
+	// Here is where you update the uniforms.
+	// Very likely this will be where you will be writing the logic of your application.
+	void updateUniformBuffer(uint32_t currentImage) {
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(infoModel.indices.size()), 1, 0, 0, 0);
+		/* L TOGGLES BETWEEN THROUGHPUT AND LOW LATENCY PACING */
+		static bool lWasPressed = false;
+		bool lPressed = glfwGetKey(window, GLFW_KEY_L);
+		if (lPressed && !lWasPressed) {
+			FramePacing pacing;
+			if (!framePacing.lowLatency) {
+				pacing.framesInFlight = 1;
+				pacing.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+				pacing.lowLatency = true;
+			}
+			setFramePacing(pacing);
+		}
+		lWasPressed = lPressed;
 		
-		/*---------------------------------------------------*/
+		/* INPUT FOR THE SIMULATION THREAD */
 
-		/* CREATING THE BUFFER FOR THE level0 */
-		VkBuffer vertexBuffers8[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets8[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers8, offsets8);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l0DS.descriptorSets[currentImage],
-			0, nullptr);
+		sampleInput();
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		/*---------------------------------------------------------------------*/
 
-		/* CREATING THE BUFFER FOR THE level1 */
-		VkBuffer vertexBuffers9[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets9[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers9, offsets9);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l1DS.descriptorSets[currentImage],
-			0, nullptr);
+		/* TRANSFORMS INTERPOLATED BETWEEN THE LAST TWO STEPS */
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		snapshots.update();
+		const SimSnapshot& snap = snapshots.readBuffer();
+		renderedState = snap.state;
+		float alpha = std::chrono::duration<float, std::chrono::seconds::period>(
+			std::chrono::steady_clock::now() - snap.stepTime).count() / SIM_STEP;
+		alpha = glm::clamp(alpha, 0.f, 1.f);
 
-		/* CREATING THE BUFFER FOR THE level2 */
-		VkBuffer vertexBuffers10[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets10[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers10, offsets10);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l2DS.descriptorSets[currentImage],
-			0, nullptr);
+		boatObject.renderPos = glm::mix(snap.previous.boatPos, snap.current.boatPos, alpha);
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		// the update functions of the objects to draw add them to the list,
+		// and the sprites to the HUD
+		visibleObjects.clear();
+		hud.begin();
 
-		/* CREATING THE BUFFER FOR THE level3 */
-		VkBuffer vertexBuffers11[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets11[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers11, offsets11);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l3DS.descriptorSets[currentImage],
-			0, nullptr);
+		switch (snap.state) {
+		case PLAYING:
+			updateRocks(snap, alpha);
+			updateLandscapes(snap, alpha);
+			updateBoat(snap, alpha);
+			updateFinishLine(snap);
+			updateLevel(snap);
+			updateInfo();
+			updateStats(snap);
+		break;
+		case WELCOME_PAGE:
+			updateWelcomePage();
+		break;
+		case LOST:
+			updateInfo();
+			updateLevel(snap);
+			updateStats(snap);
+			updateBoat(snap, alpha);
+			updateFinishLine(snap);
+			updateLostPage();
+		break;
+		case WIN:
+			updateInfo();
+			updateLevel(snap);
+			updateStats(snap);
+			updateBoat(snap, alpha);
+			updateFinishLine(snap);
+			updateWonPage();
+		break;
+		case PAUSE:
+			// a level has just been selected
+			updateBoat(snap, alpha);
+			updateFinishLine(snap);
+		break;
+		}
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		/*---------------------------------------------------------------------*/
 
-		/* CREATING THE BUFFER FOR THE level4 */
-		VkBuffer vertexBuffers12[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets12[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers12, offsets12);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l4DS.descriptorSets[currentImage],
-			0, nullptr);
+		/* UPDATE THE GLOBAL UBO */
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		updateGlobalUBO(snap, currentImage);
 
-		/* CREATING THE BUFFER FOR THE level5 */
-		VkBuffer vertexBuffers13[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets13[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers13, offsets13);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l5DS.descriptorSets[currentImage],
-			0, nullptr);
+		/*---------------------------------------------------------------------*/
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		/* UPLOAD THE INSTANCE BUFFER */
 
-		/* CREATING THE BUFFER FOR THE level6 */
-		VkBuffer vertexBuffers14[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets14[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers14, offsets14);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l6DS.descriptorSets[currentImage],
-			0, nullptr);
+		updateInstances(currentImage);
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		/*---------------------------------------------------------------------*/
 
-		/* CREATING THE BUFFER FOR THE level7 */
-		VkBuffer vertexBuffers15[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets15[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers15, offsets15);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l7DS.descriptorSets[currentImage],
-			0, nullptr);
+		/* THE INDIRECT DRAW COMMANDS */
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
+		buildDrawList(currentImage);
+		buildRenderQueue();
+		hud.upload(currentImage);
 
-		/* CREATING THE BUFFER FOR THE level8 */
-		VkBuffer vertexBuffers16[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets16[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers16, offsets16);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l8DS.descriptorSets[currentImage],
-			0, nullptr);
+		/*---------------------------------------------------------------------*/
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
 		
-		/*---------------------------------------------------*/
-
-		/* CREATING THE BUFFER FOR THE level9 */
-		VkBuffer vertexBuffers17[] = { l1Model.vertexBuffer };
-		VkDeviceSize offsets17[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers17, offsets17);
-		vkCmdBindIndexBuffer(commandBuffer, l1Model.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &l9DS.descriptorSets[currentImage],
-			0, nullptr);
+	}	
 
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(l1Model.indices.size()), 1, 0, 0, 0);
-		
-		/*---------------------------------------------------*/
-	
+	// The welcome, lost and won pages do not move: they are drawn again only
+	// when the simulation thread changes the game state (or on input)
+	bool isFrameStatic() {
+		snapshots.update();
+		int current = snapshots.readBuffer().state;
+		return current != PLAYING && current != PAUSE && current == renderedState;
 	}
 
-	// Here is where you update the uniforms.
-	// Very likely this will be where you will be writing the logic of your application.
-	void updateUniformBuffer(uint32_t currentImage) {
-		
-		switch (state) {
-		case PLAYING:
-
-			/* UBO FOR THE ROCKS */
-
-			updateRocks(currentImage);
-
-			/*---------------------------------------------------------------------*/
-
-			/* UBO FOR THE GRASS AND WATER */
-
-			updateLandscapes(currentImage);
-
-			/*---------------------------------------------------------------------*/
-
-			/*UBO FOR THE BOAT*/
-
-			updateBoat(currentImage);
-
-			/*---------------------------------------------------------------------*/
-
-			/* UBO FOR THE FINISH LINE */
-
-			updateFinishLine(currentImage);
+	void sampleInput() {
+		uint32_t keys = 0;
+		if (glfwGetKey(window, GLFW_KEY_P))
+			keys |= INPUT_PLAY;
+		if (glfwGetKey(window, GLFW_KEY_D) || glfwGetKey(window, GLFW_KEY_RIGHT))
+			keys |= INPUT_RIGHT;
+		if (glfwGetKey(window, GLFW_KEY_A) || glfwGetKey(window, GLFW_KEY_LEFT))
+			keys |= INPUT_LEFT;
+		for (int i = 0; i < 10; i++) {
+			if (glfwGetKey(window, GLFW_KEY_0 + i))
+				keys |= INPUT_LEVEL_0 << i;
+		}
+		inputKeys.store(keys, std::memory_order_relaxed);
+	}
 
-			/*---------------------------------------------------------------------*/
+	bool isPressed(uint32_t key) {
+		return (simInput & key) != 0;
+	}
 
-			/* UBO FOR THE LEVEL */
+	// Runs on the simulation thread: one step every SIM_STEP seconds. If it
+	// falls far behind (e.g. stopped in a debugger) it does not try to catch up
+	void simulationLoop() {
+		const auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<float>(SIM_STEP));
+		auto nextStep = std::chrono::steady_clock::now();
 
-			updateLevel(currentImage);
+		while (simRunning.load(std::memory_order_relaxed)) {
+			nextStep += step;
+			std::this_thread::sleep_until(nextStep);
 
-			/*---------------------------------------------------------------------*/
+			simInput = inputKeys.load(std::memory_order_relaxed);
+			simulate();
+			publishSnapshot();
 
-			/* UBO FOR THE INFO */
+			auto now = std::chrono::steady_clock::now();
+			if (now - nextStep > std::chrono::milliseconds(250)) {
+				nextStep = now;
+			}
+		}
+	}
 
-			updateInfo(currentImage);
+	void stopSimulation() {
+		if (simThread.joinable()) {
+			simRunning = false;
+			simThread.join();
+		}
+	}
 
-			/*---------------------------------------------------------------------*/
+	void publishSnapshot() {
+		SimSnapshot& snap = snapshots.writeBuffer();
+		snap.current = sim;
+		snap.previous = simPrevious;
+		snap.state = state;
+		snap.levelLabel = levelLabel;
+		snap.distanceFinishLine = level.distanceFinishLine;
+		snap.posCameraY = level.posCameraY;
+		snap.stepTime = std::chrono::steady_clock::now();
+		snapshots.publish();
+	}
 
-			/* HIDING ALL PAGES */
+	// One step of the game logic, SIM_STEP seconds long
+	void simulate() {
 
-			hideWelcomePage(currentImage);
-			hideLostPage(currentImage);
-			hideWonPage(currentImage);
-			/*---------------------------------------------------------------------*/
+		simPrevious = sim;
 
+		switch (state) {
+		case PLAYING:
+			stepRocks();
+			stepLandscapes();
+			stepBoat();
+			stepFinishLine();
 		break;
 		case WELCOME_PAGE:
-			updateWelcomePage(currentImage);
-			selectLevel(currentImage);
+			selectLevel();
 		break;
 		case LOST:
-			updateInfo(currentImage);
-			updateLevel(currentImage);
-			updateBoat(currentImage);
-			updateLostPage(currentImage);
-			selectLevel(currentImage);
-		break;
 		case WIN:
-			updateInfo(currentImage);
-			updateLevel(currentImage);
-			updateBoat(currentImage);
-			updateWonPage(currentImage);
-			selectLevel(currentImage);
+			stepBoat();
+			selectLevel();
 		break;
 		case PAUSE:
 			state = PLAYING;
 		break;
 		}
+	}
 
-		/* UPDATE THE GLOBAL UBO */
-
-		updateGlobalUBO(currentImage);
-
-		/*---------------------------------------------------------------------*/
-
-		
-	}	
-
-	void selectLevel(uint32_t currentImage) {
-		if (glfwGetKey(window, GLFW_KEY_1)) {
+	void selectLevel() {
+		if (isPressed(INPUT_LEVEL_0 << 1)) {
 			level.numberRocksLine = 1;
 			level.distanceBetweenRocksX = 14.f;
 			level.distanceFinishLine = 50.f;
@@ -813,10 +756,10 @@ class MyProject : public BaseProject {
 			level.boatSpeed.z = 5.f;
 			level.posCameraY = 10.f;
 			firstTime = true;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l1;
 		}
-		else if (glfwGetKey(window, GLFW_KEY_2)) {
+		else if (isPressed(INPUT_LEVEL_0 << 2)) {
 			level.numberRocksLine = 2;
 			level.distanceBetweenRocksX = 14.f;
 			level.distanceFinishLine = 200.f;
@@ -824,12 +767,12 @@ class MyProject : public BaseProject {
 			level.boatSpeed.z = 8.f;
 			level.posCameraY = 10.f;
 			firstTime = true;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l2;
 
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_3)) {
+		else if (isPressed(INPUT_LEVEL_0 << 3)) {
 			level.numberRocksLine = 3;
 			level.distanceBetweenRocksX = 14.f;
 			level.distanceFinishLine = 360.f;
@@ -837,12 +780,12 @@ class MyProject : public BaseProject {
 			level.boatSpeed.z = 11.f;
 			level.posCameraY = 10.f;
 			firstTime = true;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l3;
 
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_4)) {
+		else if (isPressed(INPUT_LEVEL_0 << 4)) {
 			level.numberRocksLine = 3;
 			level.distanceBetweenRocksX = 14.f;
 			level.distanceFinishLine = 780.f;
@@ -850,656 +793,393 @@ class MyProject : public BaseProject {
 			level.boatSpeed.z = 12.f;
 			level.posCameraY = 10.f;
 			firstTime = true;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l4;
 
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_5)) {
+		else if (isPressed(INPUT_LEVEL_0 << 5)) {
 			level.numberRocksLine = 4;
 			level.distanceBetweenRocksX = 15.f;
 			level.distanceFinishLine = 840.f;
 			level.boatSpeed.x = 14.f;
 			level.boatSpeed.z = 15.f;
 			level.posCameraY = 10.f;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l5;
 			firstTime = true;
 
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_6)) {
+		else if (isPressed(INPUT_LEVEL_0 << 6)) {
 			level.numberRocksLine = 4;
 			level.distanceBetweenRocksX = 16.f;
 			level.distanceFinishLine = 960.f;
 			level.boatSpeed.x = 16.f;
 			level.boatSpeed.z = 18.f;
 			level.posCameraY = 10.f;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l6;
 			firstTime = true;
 
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_7)) {
+		else if (isPressed(INPUT_LEVEL_0 << 7)) {
 			level.numberRocksLine = 4;
 			level.distanceBetweenRocksX = 16.f;
 			level.distanceFinishLine = 1080.f;
 			level.boatSpeed.x = 18.f;
 			level.boatSpeed.z = 20.f;
 			level.posCameraY = 10.f;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l7;
 			firstTime = true;
 
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_8)) {
+		else if (isPressed(INPUT_LEVEL_0 << 8)) {
 			level.numberRocksLine = 4;
 			level.distanceBetweenRocksX = 18.f;
 			level.distanceFinishLine = 1200.f;
 			level.boatSpeed.x = 20.f;
 			level.boatSpeed.z = 22.f;
 			level.posCameraY = 10.f;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l8;
 			firstTime = true;
 
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_9)) {
+		else if (isPressed(INPUT_LEVEL_0 << 9)) {
 			level.numberRocksLine = 4;
 			level.distanceBetweenRocksX = 18.f;
 			level.distanceFinishLine = 1440.f;
 			level.boatSpeed.x = 24.f;
 			level.boatSpeed.z = 26.f;
 			level.posCameraY = 10.f;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l9;
 			firstTime = true;
 		}
 
-		else if (glfwGetKey(window, GLFW_KEY_0)) {
+		else if (isPressed(INPUT_LEVEL_0 << 0)) {
 			level.numberRocksLine = 4;
 			level.distanceBetweenRocksX = 18.f;
 			level.distanceFinishLine = 2880.f;
 			level.boatSpeed.x = 32.f;
 			level.boatSpeed.z = 34.f;
 			level.posCameraY = 10.f;
-			resetLevel(currentImage);
+			resetLevel();
 			levelLabel = l0;
 			firstTime = true;
 		}
 	}
 
-	void resetLevel(uint32_t currentImage) {		
-
-		hideL0(currentImage);
-		hideL1(currentImage);
-		hideL2(currentImage);
-		hideL3(currentImage);
-		hideL4(currentImage);
-		hideL5(currentImage);
-		hideL6(currentImage);
-		hideL7(currentImage);
-		hideL8(currentImage);
-		hideL9(currentImage);
-		updateBoat(currentImage);
-		hideWelcomePage(currentImage);
-		hideLostPage(currentImage);
-		hideWonPage(currentImage);
+	// The objects jump to their new place: nothing is interpolated
+	void resetLevel() {		
+
 		state = PAUSE;
 
-		boatObject.currentPos.x = -5.f;
-		boatObject.currentPos.z = 0.f;
+		sim.boatPos.x = -5.f;
+		sim.boatPos.z = 0.f;
 
 		float i = -10.f;
-		for (auto& obj : landscapeObjects) {
-			obj.currentPosX = i;
+		for (auto& posX : sim.landscapePosX) {
+			posX = i;
 			i += 10.f;
 		}
 
 
-		for (auto& obj : rockObjects) {	
-			obj.currentPos = glm::vec3(-20.f, 0.f, 0.f);
+		for (auto& pos : sim.rockPos) {	
+			pos = glm::vec3(-20.f, 0.f, 0.f);
 		}
 
-	}
-
-	void updateLostPage(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x -7.25f, 6.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 3.22f, 1.f));
-
-		vkMapMemory(device, lostPageDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, lostPageDS.uniformBuffersMemory[0][currentImage]);
+		simPrevious = sim;
 
 	}
 
-	void updateWonPage(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x -7.25f, 6.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 3.22f, 1.f));
-
-		vkMapMemory(device, wonPageDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, wonPageDS.uniformBuffersMemory[0][currentImage]);
-
+	// The sprites are placed in pixels: the sizes are fractions of the height
+	// of the window, with the aspect ratio of their texture
+	glm::vec2 spriteSize(const Texture& texture, float height) {
+		float h = height * swapChainExtent.height;
+		return glm::vec2(h * texture.width / texture.height, h);
 	}
 
-	void updateLevel(uint32_t currentImage) {
-
-		hideL0(currentImage);
-		hideL1(currentImage);
-		hideL2(currentImage);
-		hideL3(currentImage);
-		hideL4(currentImage);
-		hideL5(currentImage);
-		hideL6(currentImage);
-		hideL7(currentImage);
-		hideL8(currentImage);
-		hideL9(currentImage);
-
-		switch (levelLabel) {
-		case l0:
-			updateL0(currentImage);
-			break;
-		case l1:
-			updateL1(currentImage);
-			break;
-		case l2:
-			updateL2(currentImage);
-			break;
-		case l3:
-			updateL3(currentImage);
-			break;
-		case l4:
-			updateL4(currentImage);
-			break;
-		case l5:
-			updateL5(currentImage);
-			break;
-		case l6:
-			updateL6(currentImage);
-			break;
-		case l7:
-			updateL7(currentImage);
-			break;
-		case l8:
-			updateL8(currentImage);
-			break;
-		case l9:
-			updateL9(currentImage);
-			break;
-		}
-
+	// The lost and won pages are over the HUD, in the upper part of the
+	// window, 80% as wide as it
+	void addPage(const Texture& texture, DescriptorSet& ds) {
+		glm::vec2 extent(swapChainExtent.width, swapChainExtent.height);
+		glm::vec2 size(0.8f * extent.x, 0.8f * extent.x * texture.height / texture.width);
+		hud.add(ds, glm::vec2((extent.x - size.x) / 2.f, 0.3f * extent.y - size.y / 2.f), size, 1);
 	}
 
-	void updateInfo(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
+	void updateLostPage() {
 
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, +7.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 3.534f, 1.f));
-
-		vkMapMemory(device, infoDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, infoDS.uniformBuffersMemory[0][currentImage]);
+		addPage(lostPageTexture, lostPageDS);
 
 	}
 
-	void updateL0(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
+	void updateWonPage() {
 
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l0DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l0DS.uniformBuffersMemory[0][currentImage]);
+		addPage(wonPageTexture, wonPageDS);
 
 	}
 
-	void updateL1(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l1DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l1DS.uniformBuffersMemory[0][currentImage]);
-
+	// The lines of text are a multiple of the height of the glyphs, about
+	// 1/30 of the window (at least 2 pixels a glyph pixel)
+	float textHeight(int scale = 1) {
+		int pixel = std::max(2, static_cast<int>(swapChainExtent.height / (30 * Font::GLYPH_HEIGHT)));
+		return static_cast<float>(scale * pixel * Font::GLYPH_HEIGHT);
 	}
 
-	void updateL2(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l2DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l2DS.uniformBuffersMemory[0][currentImage]);
-
+	// With a shadow, to be read over the water and the grass
+	void addText(const TextLayout& text, glm::vec2 pos) {
+		float shadow = text.height / Font::GLYPH_HEIGHT;
+		hud.addText(text, pos + glm::vec2(shadow), 0, glm::vec4(0.f, 0.f, 0.f, 0.6f));
+		hud.addText(text, pos);
 	}
 
-	void updateL3(uint32_t currentImage) {
+	// Top-left corner
+	void updateLevel(const SimSnapshot& snap) {
 
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l3DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l3DS.uniformBuffersMemory[0][currentImage]);
+		float margin = 0.02f * swapChainExtent.height;
+		levelText.set(font, "LEVEL " + std::to_string(snap.levelLabel), textHeight(2));
+		addText(levelText, glm::vec2(margin, margin));
 
 	}
 
-	void updateL4(uint32_t currentImage) {
+	// Below the level: the distance to the finish line, the speed of the
+	// boat and the frames per second
+	void updateStats(const SimSnapshot& snap) {
 
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l4DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l4DS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void updateL5(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l5DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l5DS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void updateL6(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
+		float margin = 0.02f * swapChainExtent.height;
+		float line = textHeight() * 1.5f;
+		glm::vec2 pos(margin, margin + levelText.size.y + line);
 
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
+		float distance = std::max(0.f, snap.distanceFinishLine - snap.current.boatPos.x);
+		distanceText.set(font, "FINISH " + std::to_string(static_cast<int>(distance)) + " M",
+						 textHeight());
+		addText(distanceText, pos);
 
-		vkMapMemory(device, l6DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l6DS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void updateL7(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l7DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l7DS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void updateL8(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l8DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l8DS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void updateL9(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(boatObject.currentPos.x +0.8f, 8.3f, -7.9f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(51.3f), glm::vec3(0.f, 1.f, 0.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 2.674f, 1.f));
-
-		vkMapMemory(device, l9DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l9DS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void hideLostPage(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, lostPageDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, lostPageDS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void hideWonPage(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, wonPageDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, wonPageDS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void hideInfo(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, infoDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, infoDS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void hideL0(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l0DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l0DS.uniformBuffersMemory[0][currentImage]);
-
-	}
-
-	void hideL1(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l1DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l1DS.uniformBuffersMemory[0][currentImage]);
-
-	}
+		float speed = glm::length(snap.current.boatPos - snap.previous.boatPos) / SIM_STEP;
+		speedText.set(font, "SPEED " + std::to_string(static_cast<int>(speed + 0.5f)) + " M/S",
+					  textHeight());
+		addText(speedText, pos + glm::vec2(0.f, line));
 
-	void hideL2(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l2DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l2DS.uniformBuffersMemory[0][currentImage]);
+		if (frameStats.frameTime > 0.f) {
+			float fps = 1000.f / frameStats.frameTime;
+			fpsAverage = (fpsAverage == 0.f) ? fps : 0.95f * fpsAverage + 0.05f * fps;
+		}
+		fpsText.set(font, "FPS " + std::to_string(static_cast<int>(fpsAverage + 0.5f)),
+					textHeight());
+		addText(fpsText, pos + glm::vec2(0.f, 2.f * line));
 
 	}
 
-	void hideL3(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
+	// Top-right corner
+	void updateInfo() {
 
-		vkMapMemory(device, l3DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l3DS.uniformBuffersMemory[0][currentImage]);
+		float margin = 0.02f * swapChainExtent.height;
+		glm::vec2 size = spriteSize(infoTexture, 0.08f);
+		hud.add(infoDS, glm::vec2(swapChainExtent.width - margin - size.x, margin), size);
 
 	}
 
-	void hideL4(uint32_t currentImage) {
+	// The whole window, keeping the aspect ratio of the page
+	void updateWelcomePage() {
 
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l4DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l4DS.uniformBuffersMemory[0][currentImage]);
+		glm::vec2 extent(swapChainExtent.width, swapChainExtent.height);
+		float scale = std::min(extent.x / welcomeTexture.width, extent.y / welcomeTexture.height);
+		glm::vec2 size = glm::vec2(welcomeTexture.width, welcomeTexture.height) * scale;
+		hud.add(welcomeDS, (extent - size) / 2.f, size, 1);
 
 	}
 
-	void hideL5(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l5DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l5DS.uniformBuffersMemory[0][currentImage]);
+	void updateGlobalUBO(const SimSnapshot& snap, uint32_t currentImage) {
 
-	}
-
-	void hideL6(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
+		/*Creating the Global UBO and copy the data to the GPU if it changed*/
+		GlobalUniformBufferObject gubo{};
 
-		vkMapMemory(device, l6DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l6DS.uniformBuffersMemory[0][currentImage]);
+		gubo.view = glm::lookAt(glm::vec3(-8.0f + boatObject.renderPos.x, snap.posCameraY, 0.f),
+			glm::vec3(boatObject.renderPos.x, 0.f, 0.f),
+			glm::vec3(0.0f, 1.0f, 0.0f));
 
-	}
+		gubo.proj = glm::perspective(glm::radians(90.0f),
+			swapChainExtent.width / (float)swapChainExtent.height,
+			0.1f, FAR_PLANE);
+		gubo.proj[1][1] *= -1;
 
-	void hideL7(uint32_t currentImage) {
+		globalUBO.set(gubo);
+		if (!globalUBO.isStale(currentImage)) {
+			frameStats.uploadsSkipped++;
+			return;
+		}
 
-		UniformBufferObject ubo{};
 		void* data;
 
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l7DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l7DS.uniformBuffersMemory[0][currentImage]);
+		vkMapMemory(device, DSglobal.uniformBuffersMemory[0][currentImage], 0, sizeof(gubo), 0, &data);
+		memcpy(data, &globalUBO.value, sizeof(gubo));
+		vkUnmapMemory(device, DSglobal.uniformBuffersMemory[0][currentImage]);
+		globalUBO.markUploaded(currentImage);
+		frameStats.uploadsWritten++;
+		frameStats.uploadBytes += sizeof(gubo);
 
 	}
 
-	void hideL8(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
+	// Every swap chain image has its own copy of the instance buffer:
+	// only the transforms that this copy holds in an old version are written
+	void updateInstances(uint32_t currentImage) {
 		void* data;
 
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l8DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l8DS.uniformBuffersMemory[0][currentImage]);
-
+		vkMapMemory(device, DSinst.uniformBuffersMemory[0][currentImage], 0,
+			sizeof(InstanceObject) * instanceCount(), 0, &data);
+		InstanceObject* grass = static_cast<InstanceObject*>(data);
+		InstanceObject* water = grass + landscapeObjects.size();
+		InstanceObject* rocks = water + landscapeObjects.size();
+		for (auto& obj : landscapeObjects) {
+			// the grass and the water of a tile share its transform
+			if (obj.transform.isStale(currentImage)) {
+				writeInstance(obj.transform, grass, GrassTexture.textureIndex);
+				writeInstance(obj.transform, water, WaterTexture.textureIndex);
+				obj.transform.markUploaded(currentImage);
+			} else {
+				frameStats.uploadsSkipped += 2;
+			}
+			grass++;
+			water++;
+		}
+		for (auto& obj : rockObjects) {
+			if (obj.transform.isStale(currentImage)) {
+				writeInstance(obj.transform, rocks, Rock1Texture.textureIndex);
+				obj.transform.markUploaded(currentImage);
+			} else {
+				frameStats.uploadsSkipped++;
+			}
+			rocks++;
+		}
+		// the visible objects move with the boat: always written
+		if (bindlessSupported) {
+			InstanceObject* objects = rocks;
+			for (const auto& obj : visibleObjects) {
+				objects->model = obj.pc->model;
+				objects->texIndex = obj.pc->texIndex;
+				objects++;
+				frameStats.uploadsWritten++;
+				frameStats.uploadBytes += sizeof(InstanceObject);
+			}
+		}
+		vkUnmapMemory(device, DSinst.uniformBuffersMemory[0][currentImage]);
 	}
 
-	void hideL9(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
-
-		vkMapMemory(device, l9DS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, l9DS.uniformBuffersMemory[0][currentImage]);
-
+	// Slots of DSinst: grass tiles, water tiles, rocks, visible objects
+	uint32_t instanceCount() {
+		return static_cast<uint32_t>(2 * landscapeObjects.size() + rockObjects.size()) +
+			MAX_VISIBLE_OBJECTS;
 	}
 
-	void hideWelcomePage(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
+	void buildDrawList(uint32_t currentImage) {
+		const uint32_t landscapeCount = static_cast<uint32_t>(landscapeObjects.size());
+		const uint32_t rockCount = static_cast<uint32_t>(rockObjects.size());
+
+		drawCandidates.clear();
+		culler.begin(globalUBO.value.view, globalUBO.value.proj, FAR_PLANE);
+		auto addCandidate = [this](Model& model, DescriptorSet* ds, uint32_t slot,
+								   const glm::mat4& transform) {
+			drawCandidates.push_back({ &model, ds, slot });
+			if (!drawList.gpuCulling) {
+				culler.add(model, transform);
+			}
+		};
 
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.f, 1000.f, 0.f));
+		for (uint32_t k = 0; k < landscapeCount; k++) {
+			addCandidate(GrassModel, &GrassDS, k, landscapeObjects[k].transform.value);
+		}
+		for (uint32_t k = 0; k < landscapeCount; k++) {
+			addCandidate(WaterModel, &WaterDS, landscapeCount + k,
+						 landscapeObjects[k].transform.value);
+		}
+		for (uint32_t k = 0; k < rockCount; k++) {
+			addCandidate(Rock1Model, &Rock1DS, 2 * landscapeCount + k,
+						 rockObjects[k].transform.value);
+		}
+		if (bindlessSupported) {
+			uint32_t slot = 2 * landscapeCount + rockCount;
+			for (const auto& obj : visibleObjects) {
+				addCandidate(*obj.model, obj.ds, slot++, obj.pc->model);
+			}
+		}
 
-		vkMapMemory(device, welcomeDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, welcomeDS.uniformBuffersMemory[0][currentImage]);
+		drawList.begin();
+		if (drawList.gpuCulling) {
+			for (const auto& c : drawCandidates) {
+				drawList.add(*c.model, c.ds, c.slot, 1);
+			}
+		} else {
+			culler.cull();
+			for (uint32_t i = 0; i < drawCandidates.size(); i++) {
+				if (culler.visible[i]) {
+					const DrawCandidate& c = drawCandidates[i];
+					drawList.add(*c.model, c.ds, c.slot, 1);
+				}
+			}
+		}
+		drawList.upload(currentImage);
 
+		frameStats.drawsTotal = static_cast<uint32_t>(drawCandidates.size());
+		frameStats.drawsVisible = drawList.gpuCulling ?
+			drawList.culledVisible : culler.visibleCount;
 	}
 
-	void updateWelcomePage(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(-4.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f))
-			* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 0.f, 1.f))
-			* glm::scale(glm::mat4(1.f), glm::vec3(1.f, 6.132f, 4.f));
-
-		vkMapMemory(device, welcomeDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, welcomeDS.uniformBuffersMemory[0][currentImage]);
-
+	// Without bindless, the visible objects are drawn one by one with P1,
+	// front to back; the groups of the draw list are drawn with P2. With
+	// bindless there are no materials to bind: the texture is in the instance
+	void buildRenderQueue() {
+		renderQueue.clear();
+		if (!bindlessSupported) {
+			for (uint32_t k = 0; k < visibleObjects.size(); k++) {
+				const VisibleObject& obj = visibleObjects[k];
+				glm::vec4 viewPos = globalUBO.value.view * obj.pc->model[3];
+				renderQueue.add(0, P1, *obj.model, obj.ds, -viewPos.z / FAR_PLANE, k);
+			}
+		}
+		for (uint32_t g = 0; g < drawList.groups.size(); g++) {
+			const DrawList::Group& group = drawList.groups[g];
+			renderQueue.add(0, P2, *group.model, bindlessSupported ? nullptr : group.ds,
+							0.0f, g);
+		}
+		renderQueue.sort();
 	}
 
-	void updateGlobalUBO(uint32_t currentImage) {
-
-		/*Creating the Global UBO and copy the data to the GPU*/
-		GlobalUniformBufferObject gubo{};
-
-		gubo.view = glm::lookAt(glm::vec3(-8.0f + boatObject.currentPos.x, level.posCameraY, 0.f),
-			glm::vec3(boatObject.currentPos.x, 0.f, 0.f),
-			glm::vec3(0.0f, 1.0f, 0.0f));
-
-		gubo.proj = glm::perspective(glm::radians(90.0f),
-			swapChainExtent.width / (float)swapChainExtent.height,
-			0.1f, 100.0f);
-		gubo.proj[1][1] *= -1;
-
-		void* data;
-
-		vkMapMemory(device, DSglobal.uniformBuffersMemory[0][currentImage], 0, sizeof(gubo), 0, &data);
-		memcpy(data, &gubo, sizeof(gubo));
-		vkUnmapMemory(device, DSglobal.uniformBuffersMemory[0][currentImage]);
-
+	void writeInstance(const Tracked<glm::mat4> &transform, InstanceObject *dst, uint32_t texIndex) {
+		dst->model = transform.value;
+		dst->texIndex = texIndex;
+		frameStats.uploadsWritten++;
+		frameStats.uploadBytes += sizeof(InstanceObject);
 	}
 
-	void updateLandscapes(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-
-		/*UBO for the River*/
-		for (auto& obj : landscapeObjects) {
-			//std::cout << obj.currentPosX << "    " << boatObject.currentPosX << "\n";
-			ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(obj.currentPosX, 0.f, 0.f)) * glm::scale(glm::mat4(1.f), glm::vec3(0.05f, 0.05f, 0.05f));
-			
-			vkMapMemory(device, obj.grassDs.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, obj.grassDs.uniformBuffersMemory[0][currentImage]);
-
-			vkMapMemory(device, obj.waterDs.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, obj.waterDs.uniformBuffersMemory[0][currentImage]);
+	void stepLandscapes() {
 
+		/*Moving the tiles of the River behind the boat in front of it*/
+		for (size_t k = 0; k < sim.landscapePosX.size(); k++) {
+			if (sim.boatPos.x > sim.landscapePosX[k] + 15.f) {
+				sim.landscapePosX[k] = sim.landscapePosX[k] + (level.maxNumberLandscape * 10.f);
+				simPrevious.landscapePosX[k] = sim.landscapePosX[k];
+			}
 		}
 
-		for (auto& obj : landscapeObjects) {
-			if (boatObject.currentPos.x > obj.currentPosX + 15.f) {
-				obj.currentPosX = obj.currentPosX + (level.maxNumberLandscape * 10.f);
-
-				ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(obj.currentPosX, 0.f, 0.f)) * glm::scale(glm::mat4(1.f), glm::vec3(0.05f, 0.05f, 0.05f));
+	}
 
-				vkMapMemory(device, obj.grassDs.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-				memcpy(data, &ubo, sizeof(ubo));
-				vkUnmapMemory(device, obj.grassDs.uniformBuffersMemory[0][currentImage]);
+	void updateLandscapes(const SimSnapshot& snap, float alpha) {
 
-				vkMapMemory(device, obj.waterDs.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-				memcpy(data, &ubo, sizeof(ubo));
-				vkUnmapMemory(device, obj.waterDs.uniformBuffersMemory[0][currentImage]);
-			}
+		/*Transforms for the River*/
+		for (size_t k = 0; k < landscapeObjects.size(); k++) {
+			float posX = glm::mix(snap.previous.landscapePosX[k], snap.current.landscapePosX[k], alpha);
+			landscapeObjects[k].transform.set(glm::translate(glm::mat4(1.0f), glm::vec3(posX, 0.f, 0.f)) * glm::scale(glm::mat4(1.f), glm::vec3(0.05f, 0.05f, 0.05f)));
 		}
 
-
-
 	}
 
-	void updateRocks(uint32_t currentImage) {
-
-		UniformBufferObject ubo{};
-		void* data;
-		static int pos = 1;
+	void stepRocks() {
 		
 		/*
 			Size:
@@ -1511,9 +1191,10 @@ class MyProject : public BaseProject {
 		if (firstTime) {
 			int even = 0;
 			float i = level.distanceBetweenRocksX*2;
-			for (auto& obj : rockObjects) {
+			for (size_t k = 0; k < sim.rockPos.size(); k++) {
 
-				obj.currentPos = glm::vec3(i, 0.f, (std::rand() % 5 - 2) * level.distanceBetweenRocksZ);
+				sim.rockPos[k] = glm::vec3(i, 0.f, (std::rand() % 5 - 2) * level.distanceBetweenRocksZ);
+				simPrevious.rockPos[k] = sim.rockPos[k];
 				even++;
 				//std::cout << "CIAO " << i << " " << level.numberRocksLine << "\n";
 				if (even >= level.numberRocksLine) {
@@ -1526,113 +1207,99 @@ class MyProject : public BaseProject {
 		}
 		
 
-		for (auto& obj : rockObjects) {
-			if (boatObject.currentPos.z +1.f < obj.currentPos.z + 3.f && boatObject.currentPos.z - 1.f > obj.currentPos.z - 3.f && 
-					(boatObject.currentPos.x + 2.f > obj.currentPos.x - 1.f && boatObject.currentPos.x - 2.4f < obj.currentPos.x + 1.f) ) {
+		const glm::vec3& boatPos = sim.boatPos;
+		for (auto& pos : sim.rockPos) {
+			if (boatPos.z +1.f < pos.z + 3.f && boatPos.z - 1.f > pos.z - 3.f && 
+					(boatPos.x + 2.f > pos.x - 1.f && boatPos.x - 2.4f < pos.x + 1.f) ) {
 				state = LOST;
 			}
 		}
 
-		for (auto& obj : rockObjects) {
+		for (size_t k = 0; k < sim.rockPos.size(); k++) {
+			glm::vec3& pos = sim.rockPos[k];
 
-			if (boatObject.currentPos.x > obj.currentPos.x + 10.f) {
-				obj.currentPos = glm::vec3(obj.currentPos.x + level.distanceBetweenRocksX * (level.maxNumberRock / level.numberRocksLine), 0.f, (std::rand() % 5 - 2) * level.distanceBetweenRocksZ);
-				ubo.model = glm::translate(glm::mat4(1.f), obj.currentPos) * ubo.model;
-				vkMapMemory(device, obj.ds.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-				memcpy(data, &ubo, sizeof(ubo));
-				vkUnmapMemory(device, obj.ds.uniformBuffersMemory[0][currentImage]);
-			}
-			else {
-				//std::cout << obj.currentPosX << "\n";
-				ubo.model = glm::translate(glm::mat4(1.0f), obj.currentPos) * glm::scale(glm::mat4(1.0), glm::vec3(0.2, 0.5, 0.5))
-					* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 1.f, 0.f));
-				vkMapMemory(device, obj.ds.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-				memcpy(data, &ubo, sizeof(ubo));
-				vkUnmapMemory(device, obj.ds.uniformBuffersMemory[0][currentImage]);
+			if (boatPos.x > pos.x + 10.f) {
+				pos = glm::vec3(pos.x + level.distanceBetweenRocksX * (level.maxNumberRock / level.numberRocksLine), 0.f, (std::rand() % 5 - 2) * level.distanceBetweenRocksZ);
+				simPrevious.rockPos[k] = pos;
 			}
 		}
 
 	}
 
-	void updateBoat(uint32_t currentImage) {
+	void updateRocks(const SimSnapshot& snap, float alpha) {
 
-		static auto start = std::chrono::high_resolution_clock::now();
-		static float last = 0.f;
-		auto now = std::chrono::high_resolution_clock::now();
-		float time = std::chrono::duration<float, std::chrono::seconds::period>(now - start).count();
-		float delta = time - last;
-		last = time;
+		for (size_t k = 0; k < rockObjects.size(); k++) {
+			glm::vec3 pos = glm::mix(snap.previous.rockPos[k], snap.current.rockPos[k], alpha);
+			rockObjects[k].transform.set(glm::translate(glm::mat4(1.0f), pos) * glm::scale(glm::mat4(1.0), glm::vec3(0.2, 0.5, 0.5))
+				* glm::rotate(glm::mat4(1.f), glm::radians(180.f), glm::vec3(0.f, 1.f, 0.f)));
+		}
 
-		static float angle = glm::radians(0.f);
+	}
 
-		void* data;
+	void stepBoat() {
 
-		UniformBufferObject ubo{};
+		/* THE BOAT STEERS AT 60 DEGREES PER SECOND, UP TO 10 DEGREES */
+		const float steerStep = glm::radians(60.f) * SIM_STEP;
+		const float maxAngle = glm::radians(10.f);
+		float& angle = sim.boatAngle;
+		glm::vec3& boatPos = sim.boatPos;
 
-		/* ALWAYS INCREMENTING THE X POSITION OF 5.f FOR MOVING STRAIGHT */
-		if (glfwGetKey(this->window, GLFW_KEY_P))
+		if (isPressed(INPUT_PLAY))
 			state = PLAYING;
 		
 		if (state == PLAYING) {
-			boatObject.currentPos += glm::vec3(level.boatSpeed.x, 0.f, 0.f) * delta;
+			/* ALWAYS MOVING FORWARD FOR MOVING STRAIGHT */
+			boatPos += glm::vec3(level.boatSpeed.x, 0.f, 0.f) * SIM_STEP;
 
 			/* UPDATING FOR MOVING RIGHT OR LEFT */
-			if (glfwGetKey(this->window, GLFW_KEY_D) || glfwGetKey(this->window, GLFW_KEY_RIGHT)) {
-				angle = angle < glm::radians(-10.f) ? glm::radians(-10.f) : angle + glm::radians(-1.f);
-				boatObject.currentPos += glm::vec3(0.f, 0.f, level.boatSpeed.z) * delta;
-				if (boatObject.currentPos.z > 10.f - 1.f)
-					boatObject.currentPos.z = 9.f;
+			if (isPressed(INPUT_RIGHT)) {
+				angle = std::max(angle - steerStep, -maxAngle);
+				boatPos += glm::vec3(0.f, 0.f, level.boatSpeed.z) * SIM_STEP;
+				if (boatPos.z > 10.f - 1.f)
+					boatPos.z = 9.f;
 			}
-			else if (glfwGetKey(this->window, GLFW_KEY_A) || glfwGetKey(this->window, GLFW_KEY_LEFT)) {
-				angle = angle > glm::radians(10.f) ? glm::radians(10.f) : angle + glm::radians(1.f);
-				boatObject.currentPos -= glm::vec3(0.f, 0.f, level.boatSpeed.z) * delta;
-				if (boatObject.currentPos.z < -10.f + 1.f)
-					boatObject.currentPos.z = -9.f;
+			else if (isPressed(INPUT_LEFT)) {
+				angle = std::min(angle + steerStep, maxAngle);
+				boatPos -= glm::vec3(0.f, 0.f, level.boatSpeed.z) * SIM_STEP;
+				if (boatPos.z < -10.f + 1.f)
+					boatPos.z = -9.f;
 			}
 			else {
-				if (angle > glm::radians(0.f))
-					angle -= glm::radians(1.f);
-				else if (angle < glm::radians(0.f))
-					angle += glm::radians(1.f);
+				if (angle > 0.f)
+					angle = std::max(angle - steerStep, 0.f);
+				else if (angle < 0.f)
+					angle = std::min(angle + steerStep, 0.f);
 			}
-
-			
 		}
 
-		ubo.model = glm::translate(glm::mat4(1.0f), boatObject.currentPos) * glm::scale(glm::mat4(1.0), glm::vec3(0.005, 0.005, 0.005))
-				* glm::rotate(glm::mat4(1.0f), static_cast<float>(glm::radians(180.f)), glm::vec3(0.f, 1.f, 0.f))
-				* glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.f, 1.f, 0.f));
-
-			//boatObject.currentPos = pos;
-
-			//std::cout << boatObject.currentPos.x << "  " << boatObject.currentPos.z << "\n";
+	}
 
-			vkMapMemory(device, boatObject.ds.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, boatObject.ds.uniformBuffersMemory[0][currentImage]);
-		
+	void updateBoat(const SimSnapshot& snap, float alpha) {
 
+		float angle = glm::mix(snap.previous.boatAngle, snap.current.boatAngle, alpha);
 
-		
+		boatObject.pc.model = glm::translate(glm::mat4(1.0f), boatObject.renderPos) * glm::scale(glm::mat4(1.0), glm::vec3(0.005, 0.005, 0.005))
+				* glm::rotate(glm::mat4(1.0f), static_cast<float>(glm::radians(180.f)), glm::vec3(0.f, 1.f, 0.f))
+				* glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.f, 1.f, 0.f));
+		addVisible(boatObject.model, boatObject.ds, boatObject.pc);
 
 	}
 
-	void updateFinishLine(uint32_t currentImage) {
-		UniformBufferObject ubo{};
-		void* data;
+	void stepFinishLine() {
 
-		
-		if (boatObject.currentPos.x - 4.f > level.distanceFinishLine - 1.f && boatObject.currentPos.x - 8.4f < level.distanceFinishLine + 1.f) {
+		if (sim.boatPos.x - 4.f > level.distanceFinishLine - 1.f && sim.boatPos.x - 8.4f < level.distanceFinishLine + 1.f) {
 			state = WIN;
 		}	
 
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(level.distanceFinishLine, 2.f, -2.f)) * glm::scale(glm::mat4(1.f), glm::vec3(0.05f, 0.03f, 0.08f))
+	}
+
+	void updateFinishLine(const SimSnapshot& snap) {
+
+		finishLinePC.model = glm::translate(glm::mat4(1.0f), glm::vec3(snap.distanceFinishLine, 2.f, -2.f)) * glm::scale(glm::mat4(1.f), glm::vec3(0.05f, 0.03f, 0.08f))
 			* glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(0.f, 1.f, 0.f))
 			* glm::rotate(glm::mat4(1.f), glm::radians(25.f), glm::vec3(1.f, 0.f, 0.f));
+		addVisible(finishLineModel, finishLineDS, finishLinePC);
 
-		vkMapMemory(device, finishLineDS.uniformBuffersMemory[0][currentImage], 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, finishLineDS.uniformBuffersMemory[0][currentImage]);
 	}
 };
 
@@ -8,12 +8,16 @@
 #include <cstdlib>
 #include <vector>
 #include <cstring>
+#include <cctype>
 #include <optional>
 #include <set>
+#include <unordered_map>
 #include <cstdint>
+#include <limits>
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <functional>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
@@ -21,7 +25,19 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_SIMD
+#include <immintrin.h>
+#endif
+
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <deque>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -34,6 +50,9 @@
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+// Size of the bindless texture table
+const uint32_t MAX_BINDLESS_TEXTURES = 1024;
+
 // Lesson 22.0
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation"
@@ -185,6 +204,11 @@ struct Model {
 	VkDeviceMemory vertexBufferMemory;
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
+	// Bounds of the vertices: box, and sphere with the same center (xyz)
+	// and radius (w)
+	glm::vec3 aabbMin;
+	glm::vec3 aabbMax;
+	glm::vec4 boundingSphere;
 	
 	void loadModel(std::string file);
 	void createIndexBuffer();
@@ -201,12 +225,24 @@ struct Texture {
 	VkDeviceMemory textureImageMemory;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
+	// Slot of the texture in the bindless texture table
+	uint32_t textureIndex;
+	uint32_t width;
+	uint32_t height;
+	// of the sampler, set before init
+	VkFilter filter = VK_FILTER_LINEAR;
+	// a full mip chain sampled with anisotropy, or the base level only
+	bool mipmaps = true;
 	
 	void createTextureImage(std::string file);
+	void createTextureImage(const unsigned char *pixels, uint32_t width, uint32_t height);
 	void createTextureImageView();
 	void createTextureSampler();
 
 	void init(BaseProject *bp, std::string file);
+	// from RGBA pixels generated by the application
+	void init(BaseProject *bp, const std::vector<unsigned char> &pixels,
+			  uint32_t width, uint32_t height);
 	void cleanup();
 };
 
@@ -217,27 +253,92 @@ struct DescriptorSetLayoutBinding {
 };
 
 
+// Shares the Vulkan layout objects: identical binding lists (and identical
+// lists of set layouts + push constants) get the same handle, which is
+// destroyed when the last user releases it.
+struct LayoutCache {
+	typedef std::vector<uint64_t> Key;
+	struct KeyHash {
+		size_t operator()(const Key &k) const;
+	};
+	template <class H>
+	struct Entry {
+		H handle;
+		uint32_t refCount;
+	};
+
+	BaseProject *BP;
+	std::unordered_map<Key, Entry<VkDescriptorSetLayout>, KeyHash> setLayouts;
+	std::unordered_map<Key, Entry<VkPipelineLayout>, KeyHash> pipelineLayouts;
+	uint32_t created = 0;
+	uint32_t reused = 0;
+
+	void init(BaseProject *bp);
+	VkDescriptorSetLayout acquireSetLayout(
+				std::vector<VkDescriptorSetLayoutBinding> bindings);
+	void releaseSetLayout(VkDescriptorSetLayout layout);
+	VkPipelineLayout acquirePipelineLayout(
+				const std::vector<VkDescriptorSetLayout> &setLayouts,
+				const std::vector<VkPushConstantRange> &pushConstants);
+	void releasePipelineLayout(VkPipelineLayout layout);
+	void cleanup();
+};
+
+// One entry of the packed data given to vkUpdateDescriptorSetWithTemplate
+union DescriptorInfo {
+	VkDescriptorBufferInfo buffer;
+	VkDescriptorImageInfo image;
+};
+
 struct DescriptorSetLayout {
 	BaseProject *BP;
  	VkDescriptorSetLayout descriptorSetLayout;
+ 	// Writes all the bindings from an array of DescriptorInfo,
+ 	// one per element of layoutBindings
+ 	VkDescriptorUpdateTemplate updateTemplate = VK_NULL_HANDLE;
+ 	std::vector<DescriptorSetLayoutBinding> layoutBindings;
  	
  	void init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B);
 	void cleanup();
 };
 
+// The fixed function state of a pipeline: the defaults are the ones of the
+// scene (Vertex, depth tested, opaque, in BaseProject::renderPass)
+struct PipelineState {
+	VkRenderPass renderPass = VK_NULL_HANDLE;	// BaseProject::renderPass if null
+	VkVertexInputBindingDescription binding = Vertex::getBindingDescription();
+	std::vector<VkVertexInputAttributeDescription> attributes;	// of Vertex if empty
+	bool depthTest = true;
+	bool alphaBlend = false;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+};
+
 struct Pipeline {
 	BaseProject *BP;
 	VkPipeline graphicsPipeline;
   	VkPipelineLayout pipelineLayout;
   	
   	void init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader,
-  			  std::vector<DescriptorSetLayout *> D);
+  			  std::vector<DescriptorSetLayout *> D,
+  			  std::vector<VkPushConstantRange> PC = {},
+  			  const PipelineState &state = PipelineState());
   	VkShaderModule createShaderModule(const std::vector<char>& code);
   	static std::vector<char> readFile(const std::string& filename);  	
 	void cleanup();
 };
 
-enum DescriptorSetElementType {UNIFORM, TEXTURE};
+struct ComputePipeline {
+	BaseProject *BP;
+	VkPipeline pipeline;
+	VkPipelineLayout pipelineLayout;
+
+	void init(BaseProject *bp, const std::string& CompShader,
+			  std::vector<DescriptorSetLayout *> D,
+			  std::vector<VkPushConstantRange> PC = {});
+	void cleanup();
+};
+
+enum DescriptorSetElementType {UNIFORM, TEXTURE, STORAGE};
 
 struct DescriptorSetElement {
 	int binding;
@@ -246,6 +347,94 @@ struct DescriptorSetElement {
 	Texture *tex;
 };
 
+// Allocates descriptor sets from a list of pools: when the current pool is
+// exhausted (or fragmented) a new one is created, so the number of sets does
+// not need to be known in advance. A new pool holds setsPerPool sets with the
+// most descriptors of each type found in a layout so far, so the sets of the
+// layout being allocated always fit in it. resetPools() recycles all of them
+// at once, for the transient sets of a frame.
+struct DescriptorAllocator {
+	BaseProject *BP;
+	uint32_t setsPerPool;
+	VkDescriptorPool currentPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorPool> usedPools;
+	std::vector<VkDescriptorPool> freePools;
+	std::vector<VkDescriptorPoolSize> descriptorsPerSet;
+	uint32_t allocatedSets = 0;
+
+	void init(BaseProject *bp, uint32_t setsPerPool);
+	void allocate(const DescriptorSetLayout &layout, uint32_t count,
+				  std::vector<VkDescriptorSet> &sets);
+	void resetPools();
+	void printUsage(const std::string &name);
+	VkDescriptorPool grabPool();
+	VkDescriptorPool createPool();
+	void cleanup();
+};
+
+// Persistent threads that record the draws of a frame in secondary command
+// buffers. The draws are split by the game in jobs: worker w records the jobs
+// w, w + N, w + 2N... each in its own command buffer, allocated from the pool
+// of the worker for that frame in flight, and the primary executes them in
+// job order. An exception thrown by a worker is rethrown by record, on the
+// render thread.
+struct RecordWorkers {
+	BaseProject *BP;
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	uint64_t generation = 0;
+	uint32_t pending = 0;
+	bool quit = false;
+	std::exception_ptr error;	// the first thrown by a worker in the frame
+
+	// pools[frame][worker], and the command buffers allocated from them
+	std::vector<std::vector<VkCommandPool>> pools;
+	std::vector<std::vector<std::vector<VkCommandBuffer>>> buffers;
+
+	// The frame being recorded
+	uint32_t frame;
+	uint32_t jobCount;
+	VkCommandBufferInheritanceInfo inheritance;
+	std::vector<VkCommandBuffer> recorded;
+
+	void init(BaseProject *bp, uint32_t workerCount);
+	const std::vector<VkCommandBuffer> &record(uint32_t frame, uint32_t jobCount,
+								VkFramebuffer framebuffer);
+	void workerLoop(uint32_t worker);
+	VkCommandBuffer getBuffer(uint32_t worker, uint32_t i);
+	void cleanup();
+};
+
+// A thread that waits (VK_KHR_present_wait) for the frames to be shown,
+// and times them from their submit. A present and a wait on the same swap
+// chain must not run at the same time: both take the mutex, and the thread
+// polls without a timeout so it never keeps it for long.
+struct PresentTimer {
+	struct Pending {
+		VkSwapchainKHR swapChain;
+		uint64_t presentId;
+		std::chrono::steady_clock::time_point submitTime;
+	};
+
+	BaseProject *BP;
+	PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool quit = false;
+	std::deque<Pending> pending;	// in present order
+	std::atomic<float> submitToPresent{0.0f};	// ms, of the last frame shown
+
+	void init(BaseProject *bp, PFN_vkWaitForPresentKHR wait);
+	VkResult present(VkQueue queue, VkPresentInfoKHR &presentInfo,
+					 uint64_t presentId, std::chrono::steady_clock::time_point submitTime);
+	void forget(VkSwapchainKHR swapChain);
+	void threadLoop();
+	void cleanup();
+};
+
 struct DescriptorSet {
 	BaseProject *BP;
 
@@ -255,9 +444,454 @@ struct DescriptorSet {
 	
 	std::vector<bool> toFree;
 
+	DescriptorSetLayout *layout;
+	std::vector<DescriptorSetElement> elements;
+
 	void init(BaseProject *bp, DescriptorSetLayout *L,
 		std::vector<DescriptorSetElement> E);
+	void updateWithTemplate(VkDescriptorSet set, size_t image);
+	void updateWithWrites(VkDescriptorSet set, size_t image);
+	void benchmarkUpdates(int count);
+	void cleanup();
+};
+
+// The draws of a frame as VkDrawIndexedIndirectCommand records, in a host
+// visible buffer per frame in flight. The draws are grouped by mesh and
+// descriptor set (the texture, without the bindless table), and each group
+// is issued with a single call: vkCmdDrawIndexedIndirectCount when
+// available (the counts follow the commands in the buffer), otherwise
+// vkCmdDrawIndexedIndirect (one call per draw without multiDrawIndirect, and
+// plain draws if the device cannot use firstInstance in indirect draws).
+// With enableCulling() the draws are instead tested against the frustum by
+// a compute shader, which packs the visible ones in culledBuffers and counts
+// them per group in countBuffers: the groups are then always drawn with
+// vkCmdDrawIndexedIndirectCount.
+struct DrawList {
+	struct Group {
+		Model *model;
+		DescriptorSet *ds;		// the texture of the draws, for the game
+		uint32_t firstCommand;
+		std::vector<VkDrawIndexedIndirectCommand> commands;
+	};
+	// One draw to be culled, as read by the compute shader (std430)
+	struct CullObject {
+		VkDrawIndexedIndirectCommand command;
+		uint32_t group;
+		uint32_t firstCommand;	// of the group in culledBuffers
+		alignas(16) glm::vec4 boundingSphere;
+	};
+
+	BaseProject *BP;
+	uint32_t maxDraws;
+	uint32_t maxGroups;
+	std::vector<VkBuffer> buffers;
+	std::vector<VkDeviceMemory> buffersMemory;
+	std::vector<void *> mapped;
+	std::vector<Group> groups;
+	uint32_t drawCount = 0;
+
+	bool gpuCulling = false;
+	std::vector<VkBuffer> culledBuffers;
+	std::vector<VkDeviceMemory> culledBuffersMemory;
+	std::vector<VkBuffer> countBuffers;
+	std::vector<VkDeviceMemory> countBuffersMemory;
+	// the counts copied back for the statistics, read when the slot is reused
+	std::vector<VkBuffer> countReadbacks;
+	std::vector<VkDeviceMemory> countReadbacksMemory;
+	std::vector<void *> countReadbacksMapped;
+	std::vector<uint32_t> readbackGroups;
+	uint32_t culledVisible = 0;		// draws left by the GPU, some frames ago
+	DescriptorSetLayout cullLayout;
+	std::vector<VkDescriptorSet> cullSets;
+	ComputePipeline cullPipeline;
+
+	void init(BaseProject *bp, uint32_t maxDraws, uint32_t maxGroups);
+	void enableCulling(const std::string& CompShader,
+					   std::vector<DescriptorSetLayout *> D);
+	void begin();
+	void add(Model &model, DescriptorSet *ds, uint32_t firstInstance,
+			 uint32_t instanceCount);
+	void upload(uint32_t frame);
+	void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame,
+					   const std::vector<VkDescriptorSet> &sets);
+	void record(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t group);
+	VkDeviceSize countOffset(uint32_t group);
+	void cleanup();
+};
+
+// The draws of a frame, each with a 64 bit sort key: pass, pipeline, mesh,
+// material and depth, from the most to the least significant bits. The keys
+// are radix sorted, so that the draws sharing a state are adjacent, and
+// flush() issues only the binds that change the state. Every call recorded
+// is counted in bindsIssued; a call that an item would need but finds
+// already bound is counted in bindsAvoided.
+struct RenderQueue {
+	struct Item {
+		uint64_t key;
+		Pipeline *pipeline;
+		Model *mesh;
+		DescriptorSet *material;	// may be null
+		uint32_t payload;			// given back to the draw callback
+	};
+	// Binds the sets shared by the draws of a pipeline. Both callbacks return
+	// the number of vkCmdBindDescriptorSets they record.
+	typedef std::function<uint32_t(VkCommandBuffer, Pipeline &)> BindSets;
+	typedef std::function<uint32_t(VkCommandBuffer, Pipeline &, DescriptorSet &)> BindMaterial;
+	typedef std::function<void(VkCommandBuffer, const Item &)> Draw;
+
+	BaseProject *BP;
+	std::vector<Item> items;
+	std::vector<Item> sorted;
+	// small ids of the pipelines, meshes and materials, for the keys
+	std::unordered_map<const void *, uint32_t> ids;
+
+	void init(BaseProject *bp);
+	void clear();
+	void add(uint32_t pass, Pipeline &pipeline, Model &mesh,
+			 DescriptorSet *material, float depth, uint32_t payload);
+	void sort();
+	void flush(VkCommandBuffer commandBuffer, size_t first, size_t count,
+			   const BindSets &bindSets, const BindMaterial &bindMaterial,
+			   const Draw &draw);
+	uint32_t idOf(const void *object);
+};
+
+// Frustum and distance culling on the CPU. The boxes of the models are moved
+// to world space when added, and kept as a structure of arrays: cull() tests
+// them against the six planes of view * proj four at a time with SSE, eight
+// with AVX. An object is also culled when its sphere is beyond maxDistance.
+struct FrustumCuller {
+	glm::vec4 planes[6];
+	glm::vec3 eye;
+	float maxDistance;
+
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+	std::vector<uint8_t> visible;
+	uint32_t count = 0;
+	uint32_t visibleCount = 0;
+
+	void begin(const glm::mat4 &view, const glm::mat4 &proj, float distance);
+	uint32_t add(const Model &model, const glm::mat4 &transform);
+	void cull();
+};
+
+// A vertex of the 2D overlay: in pixels, from the top-left corner of the
+// swap chain image
+struct SpriteVertex {
+	glm::vec2 pos;
+	glm::vec2 texCoord;
+	glm::vec4 color;	// multiplies the texture
+
+	static VkVertexInputBindingDescription getBindingDescription();
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+};
+
+// A 5x7 pixel font, baked at init() in a glyph atlas with a cell for each
+// ASCII code (16 x 8 cells). The glyphs are white, with a transparent border
+// of one pixel, and are sampled without filtering: the text is sharp when
+// its height is a multiple of GLYPH_HEIGHT. Lowercase letters are drawn as
+// uppercase; the characters without a glyph are blank. The cell of DEL is
+// solid white (solidRect), for the panels and bars drawn with the text.
+struct Font {
+	static const int GLYPH_WIDTH = 5;
+	static const int GLYPH_HEIGHT = 7;
+	static const int CELL_WIDTH = GLYPH_WIDTH + 2;
+	static const int CELL_HEIGHT = GLYPH_HEIGHT + 2;
+
+	Texture atlas;
+	DescriptorSet ds;		// the atlas at binding 1
+	glm::vec4 texRects[128];
+	glm::vec4 solidRect;
+
+	void init(BaseProject *bp, DescriptorSetLayout *textureLayout);
+	void cleanup();
+};
+
+// A string laid out with a Font, in pixels from its top-left corner. set()
+// lays it out again only when the string or the height of the lines change:
+// a text that stays the same costs just the copy of its quads in a
+// SpriteBatch. The quads keep their memory from one string to the next.
+struct TextLayout {
+	struct Quad {
+		glm::vec2 pos;
+		glm::vec2 size;
+		glm::vec4 texRect;
+	};
+
+	Font *font = nullptr;
+	std::string text;
+	float height = 0.0f;		// of a line of glyphs, in pixels
+	glm::vec2 size = glm::vec2(0.0f);
+	std::vector<Quad> quads;	// one per glyph, blanks excluded
+
+	void set(Font &font, const std::string &text, float height);
+};
+
+// Textured rectangles drawn over the frame, in the overlay pass of the render
+// graph. The sprites added between begin() and upload() are written, as two
+// triangles each, in a host visible vertex buffer per frame in flight; they
+// are drawn by layer, and in a layer by texture, with one vkCmdDraw for each
+// run of sprites that share the texture. The pipeline is unlit, blended and
+// not depth tested, with an orthographic projection of the whole image.
+struct SpriteBatch {
+	struct Sprite {
+		DescriptorSet *texture;	// a set with the texture at binding 1
+		int layer;
+		glm::vec2 pos;			// top-left corner
+		glm::vec2 size;
+		glm::vec4 texRect;		// uv of the top-left and bottom-right corners
+		glm::vec4 color;
+	};
+	struct Batch {
+		DescriptorSet *texture;
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+	};
+
+	BaseProject *BP;
+	uint32_t maxSprites;
+	std::vector<VkBuffer> buffers;
+	std::vector<VkDeviceMemory> buffersMemory;
+	std::vector<void *> mapped;
+	std::vector<Sprite> sprites;
+	std::vector<Batch> batches;
+	Pipeline pipeline;
+
+	void init(BaseProject *bp, uint32_t maxSprites, const std::string& VertShader,
+			  const std::string& FragShader, DescriptorSetLayout *textureLayout);
+	void begin();
+	void add(DescriptorSet &texture, glm::vec2 pos, glm::vec2 size, int layer = 0,
+			 glm::vec4 texRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+			 glm::vec4 color = glm::vec4(1.0f));
+	void addText(const TextLayout &text, glm::vec2 pos, int layer = 0,
+				 glm::vec4 color = glm::vec4(1.0f));
+	void upload(uint32_t frame);
+	void record(VkCommandBuffer commandBuffer, uint32_t frame);
+	void cleanup();
+};
+
+// A frame as a list of passes that declare the images they use, run in the
+// order they are added. compile() drops the passes whose images are never
+// used, works out the layout transitions and barriers before each pass, and
+// creates the render passes; createImages() gives memory to the images of
+// the graph, shared by the images that are not in use at the same time.
+// The images are shared by the frames in flight too: the first barrier of an
+// image in a frame waits for the last use of its memory in the previous one.
+struct RenderGraph {
+	enum Access {COLOR_ATTACHMENT, DEPTH_ATTACHMENT, SAMPLED, TRANSFER_SRC,
+				 TRANSFER_DST, PRESENT};
+
+	struct Image {
+		std::string name;
+		VkFormat format;
+		bool imported;				// owned outside, given by setImported
+		VkImageUsageFlags usage = 0;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkExtent2D extent{};
+		int firstPass = -1;			// in use from firstPass to lastPass
+		int lastPass = -1;
+		VkPipelineStageFlags firstStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		VkPipelineStageFlags lastStage = 0;
+		VkAccessFlags lastAccess = 0;
+		uint32_t block = 0;			// of memory, shared with other images
+	};
+
+	struct AccessInfo {
+		VkImageLayout layout;
+		VkPipelineStageFlags stage;
+		VkAccessFlags access;
+		VkImageUsageFlags usage;
+		bool write;
+	};
+
+	struct Use {
+		uint32_t image;
+		Access access;
+	};
+
+	struct Transition {
+		uint32_t image;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+		VkPipelineStageFlags srcStage;
+		VkAccessFlags srcAccess;
+		VkPipelineStageFlags dstStage;
+		VkAccessFlags dstAccess;
+		bool firstUse;				// waits for the last use of the memory
+	};
+
+	struct Pass {
+		std::string name;
+		std::vector<Use> uses;
+		bool raster = false;		// records in a render pass on its attachments
+		bool sideEffects = false;	// kept even if its images are not used
+		bool secondary = false;		// the render pass is recorded in secondary buffers
+		VkExtent2D *area = nullptr;	// render area, the whole attachments if null
+		std::function<void(VkCommandBuffer, uint32_t)> record;
+
+		bool culled = false;
+		std::vector<Transition> transitions;	// before the pass
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		std::vector<uint32_t> attachments;	// images, in the order of the render pass
+		// by view of the imported attachment (if any), created when first used
+		std::unordered_map<VkImageView, VkFramebuffer> framebuffers;
+		VkFramebuffer currentFramebuffer = VK_NULL_HANDLE;
+	};
+
+	BaseProject *BP;
+	std::vector<Image> images;
+	std::vector<Pass> passes;
+	std::vector<Use> outputs;
+	std::vector<Transition> finalTransitions;
+	std::vector<VkDeviceMemory> blocks;
+	// last use of each block in a frame, for the first barriers of the next one
+	std::vector<VkPipelineStageFlags> blockStages;
+	std::vector<VkAccessFlags> blockAccess;
+
+	void init(BaseProject *bp);
+	uint32_t addImage(const std::string &name, VkFormat format);
+	uint32_t importImage(const std::string &name, VkFormat format);
+	uint32_t addPass(const Pass &pass);
+	void addOutput(uint32_t image, Access access);
+	void compile();
+	void createImages(VkExtent2D extent);
+	void setImported(uint32_t image, VkImage handle, VkImageView view, VkExtent2D extent);
+	void execute(VkCommandBuffer commandBuffer, uint32_t frame);
+	std::function<void()> resourceDestroyer();
+	void cleanup();
+
+	static AccessInfo accessInfo(Access access);
+	static bool isDepthFormat(VkFormat format);
+	VkFramebuffer framebuffer(uint32_t pass);
+	void recordTransitions(VkCommandBuffer commandBuffer,
+						   const std::vector<Transition> &transitions);
+};
+
+// A value that is copied in a per frame in flight buffer.
+// version counts the changes of the value, uploaded[i] is the version held by
+// the copy of frame i: the copy must be written only when the two differ.
+template <class T>
+struct Tracked {
+	T value{};
+	uint32_t version = 1;
+	std::vector<uint32_t> uploaded;
+
+	void init(size_t slots) {
+		uploaded.assign(slots, 0);
+	}
+	void set(const T &v) {
+		if(!(v == value)) {
+			value = v;
+			version++;
+		}
+	}
+	bool isStale(uint32_t slot) const {
+		return uploaded[slot] != version;
+	}
+	void markUploaded(uint32_t slot) {
+		uploaded[slot] = version;
+	}
+};
+
+// Passes the last value written by one thread to another, without locks.
+// The writer fills writeBuffer() and publishes it; the reader calls update()
+// and then reads readBuffer(), which stays valid until its next update().
+// The third buffer is the one exchanged between them.
+template <class T>
+struct TripleBuffer {
+	static const uint8_t FRESH = 4;		// set when the middle buffer is new
+
+	T buffers[3];
+	uint8_t writeIndex = 0;
+	uint8_t readIndex = 1;
+	std::atomic<uint8_t> middle{2};
+
+	T &writeBuffer() {
+		return buffers[writeIndex];
+	}
+	void publish() {
+		writeIndex = middle.exchange(writeIndex | FRESH,
+									 std::memory_order_acq_rel) & ~FRESH;
+	}
+	// true if a new value has been published since the last call
+	bool update() {
+		if(!(middle.load(std::memory_order_relaxed) & FRESH)) {
+			return false;
+		}
+		readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & ~FRESH;
+		return true;
+	}
+	const T &readBuffer() const {
+		return buffers[readIndex];
+	}
+};
+
+// Counters of the last frame
+struct FrameStats {
+	uint32_t uploadsWritten = 0;
+	uint32_t uploadsSkipped = 0;
+	float renderScale = 1.0f;
+	float frameTime = 0.0f;		// ms, since the previous frame started
+	float gpuTime = 0.0f;		// ms, of the last frame measured on the GPU
+	float inputToSubmit = 0.0f;	// ms
+	float submitToPresent = 0.0f;	// ms, of the last frame shown (present wait only)
+	float submitToGpuComplete = 0.0f;	// ms, of the last frame seen complete
+	float recordTime = 0.0f;	// ms, to record the command buffer
+	uint32_t drawsTotal = 0;	// before culling
+	uint32_t drawsVisible = 0;
+	uint32_t drawCalls = 0;		// recorded in the command buffer
+	uint32_t bindsIssued = 0;	// pipelines, buffers and sets
+	uint32_t bindsAvoided = 0;	// already bound
+	uint32_t uploadBytes = 0;	// written to uniform, instance, draw and vertex buffers
+};
+
+// How the CPU is paced against the GPU. Up to MAX_FRAMES_IN_FLIGHT slots are
+// allocated, only the first framesInFlight are used. In low latency mode the
+// CPU sleeps until just before the GPU is predicted to be free, and the input
+// is sampled right before the frame is built.
+struct FramePacing {
+	uint32_t framesInFlight = MAX_FRAMES_IN_FLIGHT;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	bool lowLatency = false;
+};
+
+
+// The counters of the last frames, over everything else while toggled with
+// toggleKey: frame, CPU (input to submit) and GPU times, a graph of the
+// frame times, draw calls, binds, bytes uploaded, culled draws and the
+// memory of each heap (used and budget with VK_EXT_memory_budget, otherwise
+// the size). It reads the FrameStats gathered by drawFrame in every build,
+// and draws its panel, graph and text with the atlas of its Font: a single
+// draw call. The text is laid out again every textPeriod seconds.
+struct PerfOverlay {
+	static const int HISTORY = 120;		// frames in the graph
+	static const uint32_t MAX_SPRITES = 1024;
+
+	BaseProject *BP;
+	int toggleKey = GLFW_KEY_F3;
+	bool visible = false;
+	double textPeriod = 0.25;
+
+	DescriptorSetLayout textureLayout;
+	Font font;
+	SpriteBatch batch;
+	TextLayout text;
+	double lastTextUpdate = 0.0;
+
+	FrameStats last;
+	float frameTimes[HISTORY] = {};
+	int historyEnd = 0;
+
+	void init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader);
+	void addFrame(const FrameStats &stats);
+	void update(uint32_t frame);
+	void record(VkCommandBuffer commandBuffer, uint32_t frame);
 	void cleanup();
+
+	std::string heapText();
 };
 
 
@@ -268,6 +902,16 @@ class BaseProject {
 	friend class Pipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
+	friend class DescriptorAllocator;
+	friend class LayoutCache;
+	friend class RecordWorkers;
+	friend class PresentTimer;
+	friend class DrawList;
+	friend class ComputePipeline;
+	friend class RenderQueue;
+	friend class RenderGraph;
+	friend class SpriteBatch;
+	friend class PerfOverlay;
 public:
 	virtual void setWindowParameters() = 0;
     void run() {
@@ -283,9 +927,6 @@ protected:
 	uint32_t windowHeight;
 	std::string windowTitle;
 	VkClearColorValue initialBackgroundColor;
-	int uniformBlocksInPool;
-	int texturesInPool;
-	int setsInPool;
 
 	// Lesson 12
     GLFWwindow* window;
@@ -298,7 +939,18 @@ protected:
     VkQueue graphicsQueue;
     VkQueue presentQueue;
 	VkCommandPool commandPool;
+	// One transient pool per frame in flight, reset as a whole when the
+	// frame slot is reused: its command buffer is recorded again every frame
+	std::vector<VkCommandPool> frameCommandPools;
 	std::vector<VkCommandBuffer> commandBuffers;
+	// The threads that record the draws: recordThreads of them (0: one per
+	// core left, up to 4); with a single core the draws are recorded inline
+	RecordWorkers recordWorkers;
+	int recordThreads = 0;
+	// VK_KHR_present_wait: the frames are timed until they are shown,
+	// otherwise only until the GPU has rendered them
+	bool presentWaitSupported = false;
+	PresentTimer presentTimer;
 
     // Lesson 14
     VkSwapchainKHR swapChain;
@@ -310,39 +962,176 @@ protected:
 	// Lesson 19
 	VkRenderPass renderPass;
 	
- 	VkDescriptorPool descriptorPool;
+ 	// Shared descriptor set layouts and pipeline layouts
+ 	LayoutCache layoutCache;
+
+ 	// Sets that live as long as the application
+ 	DescriptorAllocator descriptorAllocator;
+ 	// Transient sets, one allocator per frame in flight,
+ 	// reset when the frame slot is reused
+ 	std::vector<DescriptorAllocator> frameDescriptorAllocators;
+
+	// Bindless texture table (VK_EXT_descriptor_indexing): an array of all
+	// the textures, bound once per frame and indexed by Texture::textureIndex.
+	// When the device does not support it, the per-texture sets are used.
+	bool bindlessSupported = false;
+	DescriptorSetLayout bindlessDSL;
+	VkDescriptorPool bindlessPool = VK_NULL_HANDLE;
+	VkDescriptorSet bindlessSet = VK_NULL_HANDLE;
+	uint32_t bindlessTextureCount = 0;
 
 	// Lesson 22
 	// L22.0 --- Debugging
 	VkDebugUtilsMessengerEXT debugMessenger;
 	
-	// L22.1 --- depth buffer allocation (Z-buffer)
-	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
-	VkImageView depthImageView;
+	// L22.1 --- depth buffer allocation (Z-buffer): in the render graph
 
 	// L22.2 --- Frame buffers
-	std::vector<VkFramebuffer> swapChainFramebuffers;
 	size_t currentFrame = 0;
 
+	// Pipeline cache, saved to pipelineCacheFile at shutdown and reloaded
+	// at the next launch, so the driver does not compile the shaders again
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	std::string pipelineCacheFile = "pipeline_cache.bin";
+	bool pipelineCacheWarm = false;
+
+	// The passes of a frame, and their images
+	RenderGraph renderGraph;
+	uint32_t sceneColor;
+	uint32_t sceneDepth;
+	uint32_t swapChainOutput;
+	uint32_t scenePass;
+	// the 2D overlay, drawn on the swap chain image at its full resolution
+	uint32_t overlayPass;
+	VkRenderPass overlayRenderPass;
+
+	// Dynamic resolution: the scene is rendered in the top-left corner of an
+	// offscreen target as big as the swap chain, scaled by renderScale, and
+	// then blitted (bilinear) to the swap chain image. The scale follows the
+	// GPU time of the frames, to keep it below targetGpuTime (ms). If the
+	// swap chain images can't be blitted to, the scene is rendered on them
+	// directly, at scale 1.
+	bool swapChainBlitSupported = true;
+	VkExtent2D renderExtent;
+	float renderScale = 1.0f;
+	float minRenderScale = 0.5f;
+	float targetGpuTime = 1000.0f / 60.0f;
+	float gpuTimeAverage = 0.0f;
+	int overBudgetFrames = 0;
+	int underBudgetFrames = 0;
+
+	// GPU timestamps: two per frame in flight, at the beginning and at the
+	// end of its command buffer
+	VkQueryPool timestampPool = VK_NULL_HANDLE;
+	bool gpuTimerSupported = false;
+	float timestampPeriod = 1.0f;
+	std::vector<bool> timestampsWritten;
+
+	// Statistics of the current frame, drawn by perfOverlay (F3). The game
+	// can also show them in the window title, with statsInTitle.
+	FrameStats frameStats;
+	bool statsInTitle = false;
+	double lastStatsReport = 0.0;
+	// added by the recording threads (see RenderQueue::flush)
+	std::atomic<uint32_t> bindsIssued{0};
+	std::atomic<uint32_t> bindsAvoided{0};
+	std::atomic<uint32_t> drawCalls{0};
+
+	// The statistics drawn over the frame (F3), with the sprite shaders
+	PerfOverlay perfOverlay;
+	std::string spriteVertShader = "shaders/vertSprite.spv";
+	std::string spriteFragShader = "shaders/fragSprite.spv";
+	// VK_EXT_memory_budget: the memory used and available in each heap
+	bool memoryBudgetSupported = false;
+
+	// Frame pacing: the game can set framePacing in setWindowParameters, and
+	// change it at runtime with setFramePacing
+	FramePacing framePacing;
+	FramePacing requestedPacing;
+	bool pacingRequested = false;
+	std::vector<std::chrono::steady_clock::time_point> submitTimes;
+	std::chrono::steady_clock::time_point lastSubmitTime;
+	std::chrono::steady_clock::time_point inputSampleTime;
+	std::chrono::steady_clock::time_point lastFrameStart;
+	float cpuFrameTimeAverage = 0.0f;	// ms, from the input sampling to the submit
+	float inputToSubmit = 0.0f;
+	float submitToGpuComplete = 0.0f;
+
 	// L22.3 --- Synchronization objects
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
+
+	// Every submission is numbered with frameValue. With timeline semaphores
+	// the GPU signals frameTimeline to that value, otherwise each frame slot
+	// has a fence (inFlightFences). A resource used by frame N can be reused
+	// or destroyed when completedFrameValue() >= N.
+	bool timelineSupported = false;
+	VkSemaphore frameTimeline = VK_NULL_HANDLE;
 	std::vector<VkFence> inFlightFences;
-	std::vector<VkFence> imagesInFlight;
+	uint64_t frameValue = 0;
+	uint64_t completedValue = 0;
+	std::vector<uint64_t> slotFrameValues;
+	std::vector<std::pair<uint64_t, std::function<void()>>> deferredDestroys;
+	VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE;
+	// Set when the window is resized: the swap chain is recreated
+	bool framebufferResized = false;
+
+	// Idle mode: while the game says that its frame is static, the loop
+	// sleeps in glfwWaitEventsTimeout and draws only after an input or
+	// window event (redrawRequested), looking again at the game every
+	// idleTimeout seconds. While animating, at most frameRateCap frames per
+	// second are drawn (0: no cap).
+	bool redrawRequested = true;
+	double idleTimeout = 0.1;
+	float frameRateCap = 0.0f;
+	std::chrono::steady_clock::time_point lastCapTime;
+
+	// true if drawing a frame now would give the same image as the last one
+	virtual bool isFrameStatic() {
+		return false;
+	}
 	
 	// Lesson 12
     void initWindow() {
         glfwInit();
 
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
         window = glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+        glfwSetKeyCallback(window, keyCallback);
+        glfwSetWindowRefreshCallback(window, windowRefreshCallback);
+    }
+
+    static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
+        auto app = reinterpret_cast<BaseProject*>(glfwGetWindowUserPointer(window));
+        app->framebufferResized = true;
+    }
+
+    // presses and releases wake the idle loop: the game samples the keys
+    // when it draws
+    static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+        auto app = reinterpret_cast<BaseProject*>(glfwGetWindowUserPointer(window));
+        app->redrawRequested = true;
+        if (key == app->perfOverlay.toggleKey && action == GLFW_PRESS) {
+            app->perfOverlay.visible = !app->perfOverlay.visible;
+        }
+    }
+
+    static void windowRefreshCallback(GLFWwindow* window) {
+        auto app = reinterpret_cast<BaseProject*>(glfwGetWindowUserPointer(window));
+        app->redrawRequested = true;
     }
 
 	virtual void localInit() = 0;
 
+	// Indirect draws (see DrawList)
+	bool multiDrawIndirectSupported = false;
+	bool drawIndirectFirstInstanceSupported = false;
+	bool drawIndirectCountSupported = false;
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
 	// Lesson 12
     void initVulkan() {
 		createInstance();				// L12
@@ -350,17 +1139,29 @@ protected:
 		createSurface();				// L13
 		pickPhysicalDevice();			// L14
 		createLogicalDevice();			// L14
+		createPipelineCache();
 		createSwapChain();				// L15
 		createImageViews();				// L15
-		createRenderPass();				// L19
+		createRenderGraph();			// L19
 		createCommandPool();			// L13
-		createDepthResources();			// L22.1
-		createFramebuffers();			// L22.2
-		createDescriptorPool();			// L21
+		createFramebuffers();			// L22.1 and L22.2
+		createTimestampQueries();
+		createDescriptorAllocators();	// L21
+		createBindlessTable();
+		layoutCache.init(this);
+		perfOverlay.init(this, spriteVertShader, spriteFragShader);
 
 		localInit();
+		descriptorAllocator.printUsage("Descriptor sets");
+		for (size_t i = 0; i < frameDescriptorAllocators.size(); i++) {
+			frameDescriptorAllocators[i].printUsage("Transient descriptor sets, frame " +
+													std::to_string(i));
+		}
+		std::cout << "Layouts: " << layoutCache.created << " created, " <<
+					 layoutCache.reused << " shared\n";
 
 		createCommandBuffers();			// L22.5 (13)
+		createRecordWorkers();
 		createSyncObjects();			// L22.3 
     }
 
@@ -372,7 +1173,8 @@ protected:
     	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     	appInfo.pEngineName = "No Engine";
     	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+		// 1.2 for vkGetPhysicalDeviceFeatures2 and descriptor indexing
+		appInfo.apiVersion = VK_API_VERSION_1_2;
 		
 		VkInstanceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -544,9 +1346,14 @@ protected:
 		
 		VkPhysicalDeviceFeatures supportedFeatures;
 		vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+
+		// the descriptor update templates are core in Vulkan 1.1
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
 		
 		return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-						supportedFeatures.samplerAnisotropy;
+						supportedFeatures.samplerAnisotropy &&
+						properties.apiVersion >= VK_API_VERSION_1_1;
 	}
     
     // Lesson 13
@@ -584,6 +1391,23 @@ protected:
 	}
 
 	// Lesson 13
+	bool hasDeviceExtension(const char *name) {
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+					&extensionCount, nullptr);
+					
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+					&extensionCount, availableExtensions.data());
+
+		for (const auto& extension : availableExtensions){
+			if (strcmp(extension.extensionName, name) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
 		uint32_t extensionCount;
 		vkEnumerateDeviceExtensionProperties(device, nullptr,
@@ -653,9 +1477,138 @@ protected:
 		
 		VkPhysicalDeviceFeatures deviceFeatures{};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
+
+		std::vector<const char*> enabledExtensions = deviceExtensions;
+
+		// Indirect draws: several draws per call, instance offsets, and
+		// a draw count read from a buffer
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect;
+		drawIndirectFirstInstanceSupported = supportedFeatures.drawIndirectFirstInstance;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		drawIndirectCountSupported =
+				hasDeviceExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (drawIndirectCountSupported) {
+			enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+
+		memoryBudgetSupported =
+				hasDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		if (memoryBudgetSupported) {
+			enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+
+		// Present wait needs the frames numbered with present ids
+		bool presentWaitKnown =
+				hasDeviceExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+				hasDeviceExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+
+		// A feature structure is chained only if the device knows it: from
+		// its version or an extension
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		bool timelineKnown = properties.apiVersion >= VK_API_VERSION_1_2 ||
+				hasDeviceExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		bool indexingKnown = properties.apiVersion >= VK_API_VERSION_1_2 ||
+				hasDeviceExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+		// Descriptor indexing, for the bindless texture table
+		VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+		indexingFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+		timelineFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+		presentIdFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+		VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+		presentWaitFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+		void *queriedFeatures = nullptr;
+		if (presentWaitKnown) {
+			presentIdFeatures.pNext = queriedFeatures;
+			presentWaitFeatures.pNext = &presentIdFeatures;
+			queriedFeatures = &presentWaitFeatures;
+		}
+		if (timelineKnown) {
+			timelineFeatures.pNext = queriedFeatures;
+			queriedFeatures = &timelineFeatures;
+		}
+		if (indexingKnown) {
+			indexingFeatures.pNext = queriedFeatures;
+			queriedFeatures = &indexingFeatures;
+		}
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = queriedFeatures;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+		bindlessSupported =
+				hasDeviceExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+				indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+				indexingFeatures.descriptorBindingPartiallyBound &&
+				indexingFeatures.runtimeDescriptorArray;
+
+		VkPhysicalDeviceDescriptorIndexingFeatures enabledIndexingFeatures{};
+		enabledIndexingFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+		if (bindlessSupported) {
+			enabledIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+			enabledIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+			enabledIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+			enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		}
+		std::cout << "Bindless textures: " <<
+				(bindlessSupported ? "supported" : "not supported") << "\n";
+
+		// Timeline semaphores, for the frame lifetimes: the core (1.2)
+		// entry points are used, so the device must support Vulkan 1.2
+		timelineSupported = properties.apiVersion >= VK_API_VERSION_1_2 &&
+				timelineFeatures.timelineSemaphore;
+
+		VkPhysicalDeviceTimelineSemaphoreFeatures enabledTimelineFeatures{};
+		enabledTimelineFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		enabledTimelineFeatures.timelineSemaphore = VK_TRUE;
+		std::cout << "Timeline semaphores: " <<
+				(timelineSupported ? "supported" : "not supported, using fences") << "\n";
+
+		presentWaitSupported = presentWaitKnown &&
+				presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+		VkPhysicalDevicePresentIdFeaturesKHR enabledPresentIdFeatures{};
+		enabledPresentIdFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+		enabledPresentIdFeatures.presentId = VK_TRUE;
+		VkPhysicalDevicePresentWaitFeaturesKHR enabledPresentWaitFeatures{};
+		enabledPresentWaitFeatures.sType =
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+		enabledPresentWaitFeatures.presentWait = VK_TRUE;
+		if (presentWaitSupported) {
+			enabledExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+			enabledExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		}
+
+		void *enabledFeatures = nullptr;
+		if (presentWaitSupported) {
+			enabledPresentIdFeatures.pNext = enabledFeatures;
+			enabledPresentWaitFeatures.pNext = &enabledPresentIdFeatures;
+			enabledFeatures = &enabledPresentWaitFeatures;
+		}
+		if (timelineSupported) {
+			enabledTimelineFeatures.pNext = enabledFeatures;
+			enabledFeatures = &enabledTimelineFeatures;
+		}
+		if (bindlessSupported) {
+			enabledIndexingFeatures.pNext = enabledFeatures;
+			enabledFeatures = &enabledIndexingFeatures;
+		}
 		
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = enabledFeatures;
 		
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.queueCreateInfoCount = 
@@ -663,8 +1616,8 @@ protected:
 		
 		createInfo.pEnabledFeatures = &deviceFeatures;
 		createInfo.enabledExtensionCount =
-				static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+				static_cast<uint32_t>(enabledExtensions.size());
+		createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 			createInfo.enabledLayerCount = 
 					static_cast<uint32_t>(validationLayers.size());
@@ -679,8 +1632,95 @@ protected:
 		
 		vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+		if (drawIndirectCountSupported) {
+			cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)
+				vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+			drawIndirectCountSupported = cmdDrawIndexedIndirectCount != nullptr;
+		}
+		if (presentWaitSupported) {
+			PFN_vkWaitForPresentKHR waitForPresent = (PFN_vkWaitForPresentKHR)
+				vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+			presentWaitSupported = waitForPresent != nullptr;
+			if (presentWaitSupported) {
+				presentTimer.init(this, waitForPresent);
+			}
+		}
+		std::cout << "Present timing: " << (presentWaitSupported ?
+				"present wait" : "not supported, timing until the GPU is done") << "\n";
+		std::cout << "Indirect draws: multi draw " <<
+				(multiDrawIndirectSupported ? "yes" : "no") << ", first instance " <<
+				(drawIndirectFirstInstanceSupported ? "yes" : "no") << ", draw count " <<
+				(drawIndirectCountSupported ? "yes" : "no") << "\n";
 	}
 	
+	// The cache file is used only if it was written by the same driver on
+	// the same device: otherwise the cache starts empty (cold)
+	void createPipelineCache() {
+		std::vector<char> data;
+		std::ifstream file(pipelineCacheFile, std::ios::binary | std::ios::ate);
+		if (file.is_open()) {
+			data.resize(static_cast<size_t>(file.tellg()));
+			file.seekg(0);
+			file.read(data.data(), data.size());
+			file.close();
+		}
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+		pipelineCacheWarm = false;
+		if (data.size() >= sizeof(VkPipelineCacheHeaderVersionOne)) {
+			VkPipelineCacheHeaderVersionOne header;
+			memcpy(&header, data.data(), sizeof(header));
+			pipelineCacheWarm =
+				header.headerSize >= sizeof(VkPipelineCacheHeaderVersionOne) &&
+				header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+				header.vendorID == properties.vendorID &&
+				header.deviceID == properties.deviceID &&
+				memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+					   VK_UUID_SIZE) == 0;
+		}
+		if (!pipelineCacheWarm) {
+			data.clear();
+		}
+		std::cout << "Pipeline cache: " << (pipelineCacheWarm ? "warm, " : "cold, ") <<
+					 data.size() << " bytes loaded\n";
+
+		VkPipelineCacheCreateInfo cacheInfo{};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = data.size();
+		cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+		VkResult result = vkCreatePipelineCache(device, &cacheInfo, nullptr,
+					&pipelineCache);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+	}
+
+	void savePipelineCache() {
+		size_t size = 0;
+		vkGetPipelineCacheData(device, pipelineCache, &size, nullptr);
+		std::vector<char> data(size);
+		VkResult result = vkGetPipelineCacheData(device, pipelineCache, &size,
+					data.data());
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			std::cout << "Pipeline cache not saved\n";
+			return;
+		}
+
+		std::ofstream file(pipelineCacheFile, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cout << "Cannot write " << pipelineCacheFile << "\n";
+			return;
+		}
+		file.write(data.data(), size);
+		std::cout << "Pipeline cache: " << size << " bytes saved\n";
+	}
+
 	// Lesson 14
 	void createSwapChain() {
 		SwapChainSupportDetails swapChainSupport =
@@ -706,7 +1746,21 @@ protected:
 		createInfo.imageColorSpace = surfaceFormat.colorSpace;
 		createInfo.imageExtent = extent;
 		createInfo.imageArrayLayers = 1;
+		// the frame is blitted from the offscreen target if the images and
+		// their format allow it, and the overlay drawn on it (color
+		// attachments are always supported)
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, surfaceFormat.format,
+							&formatProperties);
+		swapChainBlitSupported =
+			(swapChainSupport.capabilities.supportedUsageFlags &
+				VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+			(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
+			(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
 		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		if (swapChainBlitSupported) {
+			createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		}
 		
 		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 		uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(),
@@ -725,7 +1779,8 @@ protected:
 		 createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 		 createInfo.presentMode = presentMode;
 		 createInfo.clipped = VK_TRUE;
-		 createInfo.oldSwapchain = VK_NULL_HANDLE;
+		 // set while the swap chain is recreated
+		 createInfo.oldSwapchain = oldSwapChain;
 		 
 		 VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
 		 if (result != VK_SUCCESS) {
@@ -757,10 +1812,11 @@ protected:
 	}
 
 	// Lesson 14
+	// FIFO is always available, and is used if the requested mode is not
 	VkPresentModeKHR chooseSwapPresentMode(
 			const std::vector<VkPresentModeKHR>& availablePresentModes) {
 		for (const auto& availablePresentMode : availablePresentModes) {
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+			if (availablePresentMode == framePacing.presentMode) {
 				return availablePresentMode;
 			}
 		}
@@ -824,99 +1880,153 @@ protected:
 		return imageView;
 	}
 	
-	// Lesson 19
-    void createRenderPass() {
-		VkAttachmentDescription depthAttachment{};
-		depthAttachment.format = VK_FORMAT_D32_SFLOAT;
-		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depthAttachment.finalLayout =
-						VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference depthAttachmentRef{};
-		depthAttachmentRef.attachment = 1;
-		depthAttachmentRef.layout = 
-						VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    	VkAttachmentDescription colorAttachment{};
-		colorAttachment.format = swapChainImageFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-		
-		VkAttachmentReference colorAttachmentRef{};
-		colorAttachmentRef.attachment = 0;
-		colorAttachmentRef.layout =
-				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		
-		VkSubpassDescription subpass{};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &colorAttachmentRef;
-		subpass.pDepthStencilAttachment = &depthAttachmentRef;
-		
-		VkSubpassDependency dependency{};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	// Lesson 19, as a render graph: the work before the scene (such as the
+	// culling dispatches), the scene in an offscreen color target with its
+	// depth buffer, the upscale of the target to the swap chain image, and
+	// the 2D overlay on top of it. Without the blit, the scene is rendered
+	// on the swap chain image.
+	void createRenderGraph() {
+		renderGraph.init(this);
+		sceneDepth = renderGraph.addImage("scene depth", VK_FORMAT_D32_SFLOAT);
+		swapChainOutput = renderGraph.importImage("swap chain", swapChainImageFormat);
+		sceneColor = swapChainOutput;
+		if (swapChainBlitSupported) {
+			sceneColor = renderGraph.addImage("scene color", swapChainImageFormat);
+		} else {
+			std::cout << "Swap chain images cannot be blitted to: fixed render scale\n";
+		}
 
-		std::array<VkAttachmentDescription, 2> attachments =
-								{colorAttachment, depthAttachment};
+		RenderGraph::Pass before;
+		before.name = "before scene";
+		before.sideEffects = true;
+		before.record = [this](VkCommandBuffer commandBuffer, uint32_t frame) {
+			recordBeforeRenderPass(commandBuffer, frame);
+		};
+		renderGraph.addPass(before);
+
+		RenderGraph::Pass scene;
+		scene.name = "scene";
+		scene.uses = {{sceneColor, RenderGraph::COLOR_ATTACHMENT},
+					  {sceneDepth, RenderGraph::DEPTH_ATTACHMENT}};
+		scene.raster = true;
+		scene.area = &renderExtent;
+		scene.record = [this](VkCommandBuffer commandBuffer, uint32_t frame) {
+			recordScene(commandBuffer, frame);
+		};
+		scenePass = renderGraph.addPass(scene);
+
+		if (swapChainBlitSupported) {
+			RenderGraph::Pass upscale;
+			upscale.name = "upscale";
+			upscale.uses = {{sceneColor, RenderGraph::TRANSFER_SRC},
+							{swapChainOutput, RenderGraph::TRANSFER_DST}};
+			upscale.record = [this](VkCommandBuffer commandBuffer, uint32_t frame) {
+				blitToSwapChain(commandBuffer);
+			};
+			renderGraph.addPass(upscale);
+		}
 
-		VkRenderPassCreateInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());;
-		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
+		RenderGraph::Pass overlay;
+		overlay.name = "overlay";
+		overlay.uses = {{swapChainOutput, RenderGraph::COLOR_ATTACHMENT}};
+		overlay.raster = true;
+		overlay.record = [this](VkCommandBuffer commandBuffer, uint32_t frame) {
+			recordOverlay(commandBuffer, frame);
+			perfOverlay.record(commandBuffer, frame);
+		};
+		overlayPass = renderGraph.addPass(overlay);
+
+		renderGraph.addOutput(swapChainOutput, RenderGraph::PRESENT);
+		renderGraph.compile();
+		// the render passes of the pipelines
+		renderPass = renderGraph.passes[scenePass].renderPass;
+		overlayRenderPass = renderGraph.passes[overlayPass].renderPass;
+	}
+
+	// Lesson 22.1 and 22.2
+	// The images of the render graph are as big as the swap chain: the
+	// scaled frame uses the top-left corner of the scene color target
+    void createFramebuffers() {
+		renderGraph.createImages(swapChainExtent);
+	}
+
+	void createTimestampQueries() {
+		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+						nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+						queueFamilies.data());
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+
+		gpuTimerSupported =
+			queueFamilies[indices.graphicsFamily.value()].timestampValidBits > 0;
+		if (!gpuTimerSupported) {
+			std::cout << "GPU timestamps not supported: fixed render scale\n";
+			return;
+		}
+
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
 
-		VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr,
-					&renderPass);
+		VkResult result = vkCreateQueryPool(device, &queryPoolInfo, nullptr,
+					&timestampPool);
 		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create render pass!");
-		}		
+			PrintVkError(result);
+			throw std::runtime_error("failed to create timestamp query pool!");
+		}
+		timestampsWritten.assign(MAX_FRAMES_IN_FLIGHT, false);
 	}
 
-	// Lesson 22.2 
-    void createFramebuffers() {
-		swapChainFramebuffers.resize(swapChainImageViews.size());
-		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-			std::array<VkImageView, 2> attachments = {
-				swapChainImageViews[i],
-				depthImageView
-			};
+	// GPU time of the last frame recorded in this slot (its fence is signaled)
+	void readGpuTime(uint32_t frame) {
+		if (!gpuTimerSupported || !timestampsWritten[frame]) {
+			return;
+		}
+		uint64_t timestamps[2];
+		VkResult result = vkGetQueryPoolResults(device, timestampPool, 2 * frame, 2,
+					sizeof(timestamps), timestamps, sizeof(uint64_t),
+					VK_QUERY_RESULT_64_BIT);
+		if (result != VK_SUCCESS) {
+			return;
+		}
+		float gpuTime = (timestamps[1] - timestamps[0]) * timestampPeriod / 1000000.0f;
+		frameStats.gpuTime = gpuTime;
+		if (swapChainBlitSupported) {
+			updateRenderScale(gpuTime);
+		}
+	}
 
-			VkFramebufferCreateInfo framebufferInfo{};
-			framebufferInfo.sType =
-				VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebufferInfo.renderPass = renderPass;
-			framebufferInfo.attachmentCount =
-							static_cast<uint32_t>(attachments.size());;
-			framebufferInfo.pAttachments = attachments.data();
-			framebufferInfo.width = swapChainExtent.width; 
-			framebufferInfo.height = swapChainExtent.height;
-			framebufferInfo.layers = 1;
-			
-			VkResult result = vkCreateFramebuffer(device, &framebufferInfo, nullptr,
-						&swapChainFramebuffers[i]);
-			if (result != VK_SUCCESS) {
-			 	PrintVkError(result);
-				throw std::runtime_error("failed to create framebuffer!");
-			}
+	// The scale goes down by 5% after 10 frames over budget, and up by 5%
+	// only after 60 frames below 75% of the budget: the gap between the two
+	// thresholds avoids oscillations
+	void updateRenderScale(float gpuTime) {
+		gpuTimeAverage = (gpuTimeAverage == 0.0f) ? gpuTime :
+						 0.9f * gpuTimeAverage + 0.1f * gpuTime;
+
+		if (gpuTimeAverage > targetGpuTime) {
+			overBudgetFrames++;
+			underBudgetFrames = 0;
+		} else if (gpuTimeAverage < 0.75f * targetGpuTime) {
+			underBudgetFrames++;
+			overBudgetFrames = 0;
+		} else {
+			overBudgetFrames = 0;
+			underBudgetFrames = 0;
+		}
+
+		if (overBudgetFrames >= 10) {
+			renderScale = std::max(minRenderScale, renderScale - 0.05f);
+			overBudgetFrames = 0;
+		} else if (underBudgetFrames >= 60) {
+			renderScale = std::min(1.0f, renderScale + 0.05f);
+			underBudgetFrames = 0;
 		}
 	}
 
@@ -928,7 +2038,9 @@ protected:
 		VkCommandPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		poolInfo.flags = 0; // Optional
+		// Only for the short lived command buffers of the uploads: the
+		// frames have their own pools (frameCommandPools)
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 		
 		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
 		if (result != VK_SUCCESS) {
@@ -937,19 +2049,6 @@ protected:
 		}
 	}
 
-	// Lesson 22.1
-	void createDepthResources() {
-		VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
-		
-		createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat,
-					VK_IMAGE_TILING_OPTIMAL,
-					VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					depthImage, depthImageMemory);
-		depthImageView = createImageView(depthImage, depthFormat,
-										 VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-	}
-
 	// Lesson 22.1
 	void createImage(uint32_t width, uint32_t height,
 					 uint32_t mipLevels, // New in Lesson 23
@@ -1229,100 +2328,289 @@ protected:
 	}
     
     // Lesson 21
-	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool *
-															 swapChainImages.size());
-		// New - Lesson 23
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(texturesInPool *
-															 swapChainImages.size());
-		//
+	void createDescriptorAllocators() {
+		descriptorAllocator.init(this, 64);
+
+		frameDescriptorAllocators.resize(MAX_FRAMES_IN_FLIGHT);
+		for (auto &allocator : frameDescriptorAllocators) {
+			allocator.init(this, 16);
+		}
+	}
+
+	// Allocates a set that is valid only for the frame being recorded
+	VkDescriptorSet allocateTransientSet(uint32_t currentFrame,
+										 const DescriptorSetLayout &layout) {
+		std::vector<VkDescriptorSet> sets;
+		frameDescriptorAllocators[currentFrame].allocate(layout, 1, sets);
+		return sets[0];
+	}
+	
+	// Bindless texture table: one binding with an array of
+	// MAX_BINDLESS_TEXTURES samplers, filled as the textures are created
+	void createBindlessTable() {
+		if (!bindlessSupported) {
+			return;
+		}
+
+		VkDescriptorSetLayoutBinding binding{};
+		binding.binding = 0;
+		binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		binding.descriptorCount = MAX_BINDLESS_TEXTURES;
+		binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		binding.pImmutableSamplers = nullptr;
+
+		// the slots that are not used by any texture are never written
+		VkDescriptorBindingFlags bindingFlags =
+				VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+		VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+		flagsInfo.sType =
+				VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		flagsInfo.bindingCount = 1;
+		flagsInfo.pBindingFlags = &bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.pNext = &flagsInfo;
+		layoutInfo.bindingCount = 1;
+		layoutInfo.pBindings = &binding;
+
+		bindlessDSL.BP = this;
+		VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo,
+									nullptr, &bindlessDSL.descriptorSetLayout);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create bindless descriptor set layout!");
+		}
+
+		VkDescriptorPoolSize poolSize{};
+		poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSize.descriptorCount = MAX_BINDLESS_TEXTURES;
 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * swapChainImages.size());
-		
-		VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr,
-									&descriptorPool);
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+		poolInfo.maxSets = 1;
+
+		result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &bindlessPool);
 		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create descriptor pool!");
+			PrintVkError(result);
+			throw std::runtime_error("failed to create bindless descriptor pool!");
+		}
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = bindlessPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &bindlessDSL.descriptorSetLayout;
+
+		result = vkAllocateDescriptorSets(device, &allocInfo, &bindlessSet);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to allocate bindless descriptor set!");
 		}
 	}
-	
-	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
+
+	// Gives the texture its slot in the table. Textures are created in
+	// localInit, before any command buffer using the table is recorded.
+	uint32_t registerTexture(Texture *tex) {
+		if (bindlessTextureCount >= MAX_BINDLESS_TEXTURES) {
+			throw std::runtime_error("too many textures for the bindless table!");
+		}
+		uint32_t index = bindlessTextureCount++;
+
+		if (bindlessSupported) {
+			VkDescriptorImageInfo imageInfo{};
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo.imageView = tex->textureImageView;
+			imageInfo.sampler = tex->textureSampler;
+
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = bindlessSet;
+			descriptorWrite.dstBinding = 0;
+			descriptorWrite.dstArrayElement = index;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pImageInfo = &imageInfo;
+
+			vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+		}
+		return index;
+	}
+
+	// Work outside of the render pass, such as compute dispatches
+	virtual void recordBeforeRenderPass(VkCommandBuffer commandBuffer, int i) {}
+	// The 2D overlay (see SpriteBatch), over the upscaled frame
+	virtual void recordOverlay(VkCommandBuffer commandBuffer, int i) {}
+	// The draws of a frame, split in jobs recorded in order. A job must bind
+	// everything it uses (pipeline, descriptor sets, buffers), since it may
+	// be recorded in a secondary command buffer of its own, on another thread.
+	// i is the frame in flight: it selects the descriptor sets to bind
+	virtual uint32_t recordJobCount() = 0;
+	virtual void recordJob(uint32_t job, VkCommandBuffer commandBuffer, int i) = 0;
+
+	// Records all the jobs inline, in order: recordScene uses it when there
+	// are no recordWorkers
+	void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) {
+		uint32_t jobCount = recordJobCount();
+		for (uint32_t job = 0; job < jobCount; job++) {
+			recordJob(job, commandBuffer, i);
+		}
+	}
+
+	void setViewportAndScissor(VkCommandBuffer commandBuffer) {
+		// Viewport and scissor are dynamic states: the pipelines do not
+		// depend on the size of the swap chain or on the render scale
+		VkViewport viewport{};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float) renderExtent.width;
+		viewport.height = (float) renderExtent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor{};
+		scissor.offset = {0, 0};
+		scissor.extent = renderExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
+
+	void createRecordWorkers() {
+		uint32_t workers = recordThreads;
+		if (workers == 0) {
+			uint32_t cores = std::thread::hardware_concurrency();
+			workers = std::min(cores > 1 ? cores - 1 : 0u, 4u);
+		}
+		recordWorkers.init(this, workers);
+		renderGraph.passes[scenePass].secondary = workers > 0;
+		std::cout << "Command buffer recording: " << workers << " worker threads\n";
+	}
 
 	// Lesson 22.5 (and 13)
     void createCommandBuffers() {
     	// Lesson 13
-    	commandBuffers.resize(swapChainFramebuffers.size());
-    	
-    	VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandPool = commandPool;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
-		
-		VkResult result = vkAllocateCommandBuffers(device, &allocInfo,
-				commandBuffers.data());
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to allocate command buffers!");
-		}
-		
-		// Lesson 22.5 --- Draw calls
-		// This is where the commands that actually draw something on screen are!
-		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo{};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // Optional
-			beginInfo.pInheritanceInfo = nullptr; // Optional
+    	// one per frame in flight, recorded for the acquired image
+    	commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+		frameCommandPools.resize(MAX_FRAMES_IN_FLIGHT);
 
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
-						VK_SUCCESS) {
-				throw std::runtime_error("failed to begin recording command buffer!");
-			}
-			
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass; 
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = {0, 0};
-			renderPassInfo.renderArea.extent = swapChainExtent;
-	
-			std::array<VkClearValue, 2> clearValues{};
-			clearValues[0].color = initialBackgroundColor;
-			clearValues[1].depthStencil = {1.0f, 0};
-	
-			renderPassInfo.clearValueCount =
-							static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-			
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
-					VK_SUBPASS_CONTENTS_INLINE);			
-	
+		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-			populateCommandBuffer(commandBuffers[i], i);
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr,
+						&frameCommandPools[i]);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to create command pool!");
+			}
+    	
+	    	VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = frameCommandPools[i];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
 			
-
-			vkCmdEndRenderPass(commandBuffers[i]);
-
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
+			result = vkAllocateCommandBuffers(device, &allocInfo,
+					&commandBuffers[i]);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to allocate command buffers!");
 			}
 		}
 	}
-    
-    // Lesson 22.5
+
+	// Lesson 22.5 --- Draw calls
+	// This is where the commands that actually draw something on screen are!
+	// Called every frame, since the per-object data travels as push constants
+	void recordCommandBuffer(uint32_t frame, uint32_t imageIndex) {
+		VkCommandBuffer commandBuffer = commandBuffers[frame];
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) !=
+					VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+
+		if (gpuTimerSupported) {
+			vkCmdResetQueryPool(commandBuffer, timestampPool, 2 * frame, 2);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+								timestampPool, 2 * frame);
+		}
+
+		renderExtent.width = std::max(1u,
+				static_cast<uint32_t>(swapChainExtent.width * renderScale));
+		renderExtent.height = std::max(1u,
+				static_cast<uint32_t>(swapChainExtent.height * renderScale));
+
+		renderGraph.setImported(swapChainOutput, swapChainImages[imageIndex],
+								swapChainImageViews[imageIndex], swapChainExtent);
+		renderGraph.execute(commandBuffer, frame);
+
+		if (gpuTimerSupported) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+								timestampPool, 2 * frame + 1);
+			timestampsWritten[frame] = true;
+		}
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
+    
+	// The scene pass: inline, or in secondary command buffers recorded by
+	// the workers
+	void recordScene(VkCommandBuffer commandBuffer, uint32_t frame) {
+		if (recordWorkers.threads.empty()) {
+			setViewportAndScissor(commandBuffer);
+			populateCommandBuffer(commandBuffer, frame);
+		} else {
+			const std::vector<VkCommandBuffer> &secondaries =
+				recordWorkers.record(frame, recordJobCount(),
+						renderGraph.passes[scenePass].currentFramebuffer);
+			if (!secondaries.empty()) {
+				vkCmdExecuteCommands(commandBuffer,
+						static_cast<uint32_t>(secondaries.size()), secondaries.data());
+			}
+		}
+	}
+
+	// Upscales the rendered part of the offscreen target to the whole
+	// swap chain image (the render graph sets the layouts)
+	void blitToSwapChain(VkCommandBuffer commandBuffer) {
+		VkImageBlit blit{};
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { static_cast<int32_t>(renderExtent.width),
+							   static_cast<int32_t>(renderExtent.height), 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = 0;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { static_cast<int32_t>(swapChainExtent.width),
+							   static_cast<int32_t>(swapChainExtent.height), 1 };
+		blit.dstSubresource = blit.srcSubresource;
+
+		vkCmdBlitImage(commandBuffer,
+					   renderGraph.images[sceneColor].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					   renderGraph.images[swapChainOutput].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					   1, &blit, VK_FILTER_LINEAR);
+	}
+    
+    // Lesson 22.5
     void createSyncObjects() {
     	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-    	imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+		slotFrameValues.assign(MAX_FRAMES_IN_FLIGHT, 0);
+		submitTimes.resize(MAX_FRAMES_IN_FLIGHT);
     	    	
     	VkSemaphoreCreateInfo semaphoreInfo{};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1336,67 +2624,342 @@ protected:
 								&imageAvailableSemaphores[i]);
 			VkResult result2 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
 								&renderFinishedSemaphores[i]);
-			VkResult result3 = vkCreateFence(device, &fenceInfo, nullptr,
-								&inFlightFences[i]);
 			if (result1 != VK_SUCCESS ||
-				result2 != VK_SUCCESS ||
-				result3 != VK_SUCCESS) {
+				result2 != VK_SUCCESS) {
 			 	PrintVkError(result1);
 			 	PrintVkError(result2);
-			 	PrintVkError(result3);
 				throw std::runtime_error("failed to create synchronization objects for a frame!!");
 			}
 		}
+
+		if (timelineSupported) {
+			VkSemaphoreTypeCreateInfo typeInfo{};
+			typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+			typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+			typeInfo.initialValue = 0;
+			semaphoreInfo.pNext = &typeInfo;
+
+			VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+								&frameTimeline);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to create the frame timeline semaphore!");
+			}
+		} else {
+			inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+			for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+				VkResult result = vkCreateFence(device, &fenceInfo, nullptr,
+									&inFlightFences[i]);
+				if (result != VK_SUCCESS) {
+				 	PrintVkError(result);
+					throw std::runtime_error("failed to create synchronization objects for a frame!!");
+				}
+			}
+		}
+	}
+
+	// The value of the last frame completed by the GPU
+	uint64_t completedFrameValue() {
+		if (timelineSupported) {
+			vkGetSemaphoreCounterValue(device, frameTimeline, &completedValue);
+		} else {
+			// the frames complete in order: the newest signaled fence is enough
+			for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+				if (slotFrameValues[i] > completedValue &&
+					vkGetFenceStatus(device, inFlightFences[i]) == VK_SUCCESS) {
+					completedValue = slotFrameValues[i];
+				}
+			}
+		}
+		return completedValue;
+	}
+
+	void waitForFrameValue(uint64_t value) {
+		if (value <= completedValue) {
+			return;
+		}
+		if (timelineSupported) {
+			VkSemaphoreWaitInfo waitInfo{};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &frameTimeline;
+			waitInfo.pValues = &value;
+			vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+			completedValue = value;
+		} else {
+			// the fence of the oldest frame that is not older than value
+			int slot = -1;
+			for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+				if (slotFrameValues[i] >= value &&
+					(slot < 0 || slotFrameValues[i] < slotFrameValues[slot])) {
+					slot = static_cast<int>(i);
+				}
+			}
+			if (slot >= 0) {
+				vkWaitForFences(device, 1, &inFlightFences[slot], VK_TRUE, UINT64_MAX);
+				completedValue = slotFrameValues[slot];
+			}
+		}
+	}
+
+	// destroy is called once the frames submitted so far are complete
+	void deferDestroy(std::function<void()> destroy) {
+		deferredDestroys.emplace_back(frameValue, std::move(destroy));
+	}
+
+	void collectDeferredDestroys() {
+		uint64_t completed = completedFrameValue();
+		auto done = std::stable_partition(deferredDestroys.begin(), deferredDestroys.end(),
+			[completed](const std::pair<uint64_t, std::function<void()>> &d) {
+				return d.first <= completed;
+			});
+		for (auto it = deferredDestroys.begin(); it != done; ++it) {
+			it->second();
+		}
+		deferredDestroys.erase(deferredDestroys.begin(), done);
 	}
     
     // Lesson 22.6 --- Main Rendering Loop
     void mainLoop() {
+        lastCapTime = std::chrono::steady_clock::now();
         while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+            if (!redrawRequested && !framebufferResized && isFrameStatic()) {
+                glfwWaitEventsTimeout(idleTimeout);
+                continue;
+            }
+            redrawRequested = false;
+
+            // in low latency mode drawFrame polls the events itself, later
+            if (!framePacing.lowLatency) {
+                glfwPollEvents();
+            }
             drawFrame();
+            capFrameRate();
         }
         
         vkDeviceWaitIdle(device);
     }
+
+	// Keeps a steady cadence: the next frame is due one period after the
+	// previous one, unless the loop is more than a period late
+	void capFrameRate() {
+		if (frameRateCap <= 0.0f) {
+			return;
+		}
+		auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<float>(1.0f / frameRateCap));
+		auto target = lastCapTime + period;
+		stampCompletedFrames();
+		std::this_thread::sleep_until(target);
+
+		auto now = std::chrono::steady_clock::now();
+		lastCapTime = (now - target > period) ? now : target;
+	}
     
     // Lesson 22.6
+    void reportFrameStats() {
+		double now = glfwGetTime();
+		if(!statsInTitle || now - lastStatsReport < 0.5) {
+			return;
+		}
+		lastStatsReport = now;
+
+		// without present wait, only the time until the GPU is done
+		char latency[64];
+		if (presentWaitSupported) {
+			snprintf(latency, sizeof(latency), "submit to present: %.2f ms",
+					 frameStats.submitToPresent);
+		} else {
+			snprintf(latency, sizeof(latency),
+					 "submit to GPU complete (fallback): %.2f ms",
+					 frameStats.submitToGpuComplete);
+		}
+		char timings[192];
+		snprintf(timings, sizeof(timings),
+				 "GPU: %.2f ms | record: %.3f ms | input to submit: %.2f ms | %s",
+				 frameStats.gpuTime, frameStats.recordTime,
+				 frameStats.inputToSubmit, latency);
+		std::string title = windowTitle +
+			" | uploads: " + std::to_string(frameStats.uploadsWritten) +
+			" written, " + std::to_string(frameStats.uploadsSkipped) + " skipped" +
+			" | visible: " + std::to_string(frameStats.drawsVisible) +
+			"/" + std::to_string(frameStats.drawsTotal) +
+			" | binds: " + std::to_string(frameStats.bindsIssued) +
+			" issued, " + std::to_string(frameStats.bindsAvoided) + " avoided" +
+			" | scale: " + std::to_string(static_cast<int>(frameStats.renderScale * 100.0f + 0.5f)) +
+			"% | " + timings;
+		glfwSetWindowTitle(window, title.c_str());
+	}
+
+	// The new pacing is applied between two frames, with the GPU idle
+	void setFramePacing(const FramePacing &pacing) {
+		requestedPacing = pacing;
+		pacingRequested = true;
+	}
+
+	void applyFramePacing() {
+		pacingRequested = false;
+		vkDeviceWaitIdle(device);
+
+		bool presentModeChanged =
+			requestedPacing.presentMode != framePacing.presentMode;
+		framePacing = requestedPacing;
+		framePacing.framesInFlight = std::clamp(framePacing.framesInFlight, 1u,
+							static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
+		currentFrame = 0;
+		cpuFrameTimeAverage = 0.0f;
+
+		std::cout << "Frame pacing: " << framePacing.framesInFlight <<
+			" frames in flight, low latency " <<
+			(framePacing.lowLatency ? "on" : "off") << "\n";
+		if (presentModeChanged) {
+			recreateSwapChain();
+		}
+	}
+
+	// Sleeps until the CPU work of the frame is predicted to end when the GPU
+	// finishes the last submitted frame
+	void waitForPredictedGpuReady() {
+		if (!framePacing.lowLatency || gpuTimeAverage == 0.0f) {
+			return;
+		}
+		const float safetyMargin = 1.0f;	// ms
+		float lead = gpuTimeAverage - cpuFrameTimeAverage - safetyMargin;
+		if (lead <= 0.0f) {
+			return;
+		}
+		std::this_thread::sleep_until(lastSubmitTime +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<float, std::milli>(lead)));
+	}
+
+	// Times the frames seen complete since the last call from their submit.
+	// The GPU signals the timeline (or fence) when the frame is rendered,
+	// not when it is presented: it is the fallback of presentTimer, without
+	// present wait. It is called before every pacing sleep and right after
+	// the wait for a slot, so the sleeps are not counted.
+	void stampCompletedFrames() {
+		uint64_t completed = completedFrameValue();
+		auto now = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			if (submitTimes[i] != std::chrono::steady_clock::time_point{} &&
+				slotFrameValues[i] <= completed) {
+				submitToGpuComplete = std::chrono::duration<float, std::milli>(
+					now - submitTimes[i]).count();
+				submitTimes[i] = std::chrono::steady_clock::time_point{};
+			}
+		}
+	}
+
     void drawFrame() {
-		vkWaitForFences(device, 1, &inFlightFences[currentFrame],
-						VK_TRUE, UINT64_MAX);
+		stampCompletedFrames();
+		waitForPredictedGpuReady();
+
+		waitForFrameValue(slotFrameValues[currentFrame]);
+		// the transient sets of this frame are no longer in use
+		frameDescriptorAllocators[currentFrame].resetPools();
+		stampCompletedFrames();
+		collectDeferredDestroys();
 		
 		uint32_t imageIndex;
 		
 		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
 				imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
 
-		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-			vkWaitForFences(device, 1, &imagesInFlight[imageIndex],
-							VK_TRUE, UINT64_MAX);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			recreateSwapChain();
+			return;
+		} else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to acquire swap chain image!");
 		}
-		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
+		// The uniform buffers, descriptor sets and command buffer of a frame
+		// slot are free once its fence is signaled, whatever the image
 		
-		updateUniformBuffer(imageIndex);
+		// the counters of the last frame are complete
+		perfOverlay.addFrame(frameStats);
+		frameStats = FrameStats{};
+		auto frameStart = std::chrono::steady_clock::now();
+		if (lastFrameStart != std::chrono::steady_clock::time_point{}) {
+			frameStats.frameTime = std::chrono::duration<float, std::milli>(
+				frameStart - lastFrameStart).count();
+		}
+		lastFrameStart = frameStart;
+		readGpuTime(currentFrame);
+		frameStats.renderScale = renderScale;
+		frameStats.inputToSubmit = inputToSubmit;
+		frameStats.submitToPresent = presentTimer.submitToPresent;
+		frameStats.submitToGpuComplete = submitToGpuComplete;
+
+		// the input is read as late as possible
+		if (framePacing.lowLatency) {
+			glfwPollEvents();
+		}
+		inputSampleTime = std::chrono::steady_clock::now();
+		updateUniformBuffer(currentFrame);
+		perfOverlay.update(currentFrame);
+
+		auto recordStart = std::chrono::steady_clock::now();
+		bindsIssued = 0;
+		bindsAvoided = 0;
+		drawCalls = 0;
+		vkResetCommandPool(device, frameCommandPools[currentFrame], 0);
+		recordCommandBuffer(currentFrame, imageIndex);
+		frameStats.recordTime = std::chrono::duration<float, std::milli>(
+			std::chrono::steady_clock::now() - recordStart).count();
+		frameStats.bindsIssued = bindsIssued;
+		frameStats.bindsAvoided = bindsAvoided;
+		frameStats.drawCalls = drawCalls;
+		reportFrameStats();
 		
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 		VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
+		// the swap chain image can be acquired until its first use in the graph
 		VkPipelineStageFlags waitStages[] =
-			{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+			{renderGraph.images[swapChainOutput].firstStage};
 		submitInfo.waitSemaphoreCount = 1;
 		submitInfo.pWaitSemaphores = waitSemaphores;
 		submitInfo.pWaitDstStageMask = waitStages;
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-		VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+		// the binary semaphore is for the presentation, the timeline one
+		// (if any) numbers the frame
+		frameValue++;
+		VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame],
+										  frameTimeline};
+		uint64_t waitValues[] = {0};
+		uint64_t signalValues[] = {0, frameValue};
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = 1;
+		timelineInfo.pWaitSemaphoreValues = waitValues;
+		timelineInfo.signalSemaphoreValueCount = 2;
+		timelineInfo.pSignalSemaphoreValues = signalValues;
 		submitInfo.pSignalSemaphores = signalSemaphores;
-		
-		vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-				inFlightFences[currentFrame]) != VK_SUCCESS) {
+		VkFence fence = VK_NULL_HANDLE;
+		if (timelineSupported) {
+			submitInfo.pNext = &timelineInfo;
+			submitInfo.signalSemaphoreCount = 2;
+		} else {
+			submitInfo.signalSemaphoreCount = 1;
+			fence = inFlightFences[currentFrame];
+			vkResetFences(device, 1, &fence);
+		}
+
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
 			throw std::runtime_error("failed to submit draw command buffer!");
 		}
+		slotFrameValues[currentFrame] = frameValue;
+
+		lastSubmitTime = std::chrono::steady_clock::now();
+		submitTimes[currentFrame] = lastSubmitTime;
+		inputToSubmit = std::chrono::duration<float, std::milli>(
+			lastSubmitTime - inputSampleTime).count();
+		cpuFrameTimeAverage = (cpuFrameTimeAverage == 0.0f) ? inputToSubmit :
+							  0.9f * cpuFrameTimeAverage + 0.1f * inputToSubmit;
 		
 		VkPresentInfoKHR presentInfo{};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1409,11 +2972,83 @@ protected:
 		presentInfo.pImageIndices = &imageIndex;
 		presentInfo.pResults = nullptr; // Optional
 		
-		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		if (presentWaitSupported) {
+			result = presentTimer.present(presentQueue, presentInfo, frameValue,
+										  lastSubmitTime);
+		} else {
+			result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		}
+
+		currentFrame = (currentFrame + 1) % framePacing.framesInFlight;
+
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
+				framebufferResized) {
+			framebufferResized = false;
+			recreateSwapChain();
+		} else if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to present swap chain image!");
+		}
 
-		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+		if (pacingRequested) {
+			applyFramePacing();
+		}
     }
 
+	// Only the objects that depend on the size of the window are rebuilt:
+	// meshes, textures, descriptor sets and pipelines are kept
+	void recreateSwapChain() {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// a minimized window has a zero sized framebuffer: wait until it is restored
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(window, &width, &height);
+		while (width == 0 || height == 0) {
+			glfwGetFramebufferSize(window, &width, &height);
+			glfwWaitEvents();
+		}
+
+		// the frames in flight keep using the old objects, which are
+		// destroyed when they are complete
+		deferDestroy(swapChainDestroyer());
+		oldSwapChain = swapChain;
+		presentTimer.forget(oldSwapChain);
+
+		createSwapChain();
+		createImageViews();
+		createFramebuffers();
+
+		oldSwapChain = VK_NULL_HANDLE;
+
+		auto end = std::chrono::high_resolution_clock::now();
+		std::cout << "Swap chain recreated (" << swapChainExtent.width << "x" <<
+			swapChainExtent.height << ") in " <<
+			std::chrono::duration<float, std::milli>(end - start).count() << " ms\n";
+	}
+
+	void cleanupSwapChain() {
+		swapChainDestroyer()();
+	}
+
+	// A function that destroys the current swap chain and the objects that
+	// depend on its size, even after they have been replaced
+	std::function<void()> swapChainDestroyer() {
+		VkDevice dev = device;
+		std::function<void()> destroyGraphImages = renderGraph.resourceDestroyer();
+		std::vector<VkImageView> oldSwapChainViews = swapChainImageViews;
+		VkSwapchainKHR oldSwapChainHandle = swapChain;
+
+		return [=]() {
+			destroyGraphImages();
+
+			for (size_t i = 0; i < oldSwapChainViews.size(); i++){
+				vkDestroyImageView(dev, oldSwapChainViews[i], nullptr);
+			}
+			
+			vkDestroySwapchainKHR(dev, oldSwapChainHandle, nullptr);
+		};
+	}
+
 	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
 
 	virtual void localCleanup() = 0;
@@ -1421,37 +3056,59 @@ protected:
 	// All lessons
 	
     void cleanup() {
-		vkDestroyImageView(device, depthImageView, nullptr);
-		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+		presentTimer.cleanup();
 
-		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+		// the device is idle: everything can go
+		for (auto &d : deferredDestroys) {
+			d.second();
 		}
+		deferredDestroys.clear();
+		cleanupSwapChain();
 		
-		vkFreeCommandBuffers(device, commandPool,
-				static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+		recordWorkers.cleanup();
+
+		// the command buffers are freed with their pools
+		for (size_t i = 0; i < frameCommandPools.size(); i++) {
+			vkDestroyCommandPool(device, frameCommandPools[i], nullptr);
+		}
 
-		vkDestroyRenderPass(device, renderPass, nullptr);
+		renderGraph.cleanup();
 
-		for (size_t i = 0; i < swapChainImageViews.size(); i++){
-			vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+		if (gpuTimerSupported) {
+			vkDestroyQueryPool(device, timestampPool, nullptr);
 		}
 		
-		vkDestroySwapchainKHR(device, swapChain, nullptr);
-		
-		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		descriptorAllocator.cleanup();
+		for (auto &allocator : frameDescriptorAllocators) {
+			allocator.cleanup();
+		}
     	
     	
 		localCleanup();
+		perfOverlay.cleanup();
+
+		if (bindlessSupported) {
+			vkDestroyDescriptorPool(device, bindlessPool, nullptr);
+			// not in the layout cache, because of its binding flags
+			vkDestroyDescriptorSetLayout(device, bindlessDSL.descriptorSetLayout, nullptr);
+		}
+		layoutCache.cleanup();
     	
     	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
 			vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-			vkDestroyFence(device, inFlightFences[i], nullptr);
     	}
+		for (size_t i = 0; i < inFlightFences.size(); i++) {
+			vkDestroyFence(device, inFlightFences[i], nullptr);
+		}
+		if (timelineSupported) {
+			vkDestroySemaphore(device, frameTimeline, nullptr);
+		}
     	
     	vkDestroyCommandPool(device, commandPool, nullptr);
+
+		savePipelineCache();
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);
     	
  		vkDestroyDevice(device, nullptr);
 		
@@ -1507,7 +3164,19 @@ void Model::loadModel(std::string file) {
 		}
 	}
 	
-	
+	// Sphere centered in the middle of the bounding box
+	aabbMin = glm::vec3(std::numeric_limits<float>::max());
+	aabbMax = glm::vec3(std::numeric_limits<float>::lowest());
+	for (const auto& vertex : vertices) {
+		aabbMin = glm::min(aabbMin, vertex.pos);
+		aabbMax = glm::max(aabbMax, vertex.pos);
+	}
+	glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+	float radius = 0.0f;
+	for (const auto& vertex : vertices) {
+		radius = std::max(radius, glm::length(vertex.pos - center));
+	}
+	boundingSphere = glm::vec4(center, radius);
 }
 
 // Lesson 21
@@ -1567,9 +3236,19 @@ void Texture::createTextureImage(std::string file) {
 		throw std::runtime_error("failed to load texture image!");
 	}
 
+	createTextureImage(pixels, static_cast<uint32_t>(texWidth),
+					   static_cast<uint32_t>(texHeight));
+	stbi_image_free(pixels);
+}
+
+// pixels: RGBA, 8 bits per channel
+void Texture::createTextureImage(const unsigned char *pixels, uint32_t texWidth,
+								 uint32_t texHeight) {
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	mipLevels = static_cast<uint32_t>(std::floor(
-					std::log2(std::max(texWidth, texHeight)))) + 1;
+	width = texWidth;
+	height = texHeight;
+	mipLevels = mipmaps ? static_cast<uint32_t>(std::floor(
+					std::log2(std::max(texWidth, texHeight)))) + 1 : 1;
 	
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingBufferMemory;
@@ -1583,8 +3262,6 @@ void Texture::createTextureImage(std::string file) {
 	memcpy(data, pixels, static_cast<size_t>(imageSize));
 	vkUnmapMemory(BP->device, stagingBufferMemory);
 	
-	stbi_image_free(pixels);
-	
 	BP->createImage(texWidth, texHeight, mipLevels, VK_FORMAT_R8G8B8A8_SRGB,
 				VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
 				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
@@ -1613,18 +3290,19 @@ void Texture::createTextureImageView() {
 void Texture::createTextureSampler() {
 	VkSamplerCreateInfo samplerInfo{};
 	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerInfo.magFilter = VK_FILTER_LINEAR;
-	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.magFilter = filter;
+	samplerInfo.minFilter = filter;
 	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.anisotropyEnable = VK_TRUE;
-	samplerInfo.maxAnisotropy = 16;
+	samplerInfo.anisotropyEnable = mipmaps ? VK_TRUE : VK_FALSE;
+	samplerInfo.maxAnisotropy = mipmaps ? 16.0f : 1.0f;
 	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
 	samplerInfo.unnormalizedCoordinates = VK_FALSE;
 	samplerInfo.compareEnable = VK_FALSE;
 	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.mipmapMode = mipmaps ? VK_SAMPLER_MIPMAP_MODE_LINEAR :
+									   VK_SAMPLER_MIPMAP_MODE_NEAREST;
 	samplerInfo.mipLodBias = 0.0f;
 	samplerInfo.minLod = 0.0f;
 	samplerInfo.maxLod = static_cast<float>(mipLevels);
@@ -1644,6 +3322,16 @@ void Texture::init(BaseProject *bp, std::string file) {
 	createTextureImage(file);
 	createTextureImageView();
 	createTextureSampler();
+	textureIndex = BP->registerTexture(this);
+}
+
+void Texture::init(BaseProject *bp, const std::vector<unsigned char> &pixels,
+				   uint32_t width, uint32_t height) {
+	BP = bp;
+	createTextureImage(pixels.data(), width, height);
+	createTextureImageView();
+	createTextureSampler();
+	textureIndex = BP->registerTexture(this);
 }
 
 void Texture::cleanup() {
@@ -1658,7 +3346,9 @@ void Texture::cleanup() {
 
 
 void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader,
-					std::vector<DescriptorSetLayout *> D) {
+					std::vector<DescriptorSetLayout *> D,
+					std::vector<VkPushConstantRange> PC,
+					const PipelineState &state) {
 	BP = bp;
 	
 	auto vertShaderCode = readFile(VertShader);
@@ -1695,8 +3385,13 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType =
 			VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	VkVertexInputBindingDescription bindingDescription = state.binding;
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions =
+			state.attributes;
+	if (attributeDescriptions.empty()) {
+		auto vertexAttributes = Vertex::getAttributeDescriptions();
+		attributeDescriptions.assign(vertexAttributes.begin(), vertexAttributes.end());
+	}
 			
 	vertexInputInfo.vertexBindingDescriptionCount = 1;
 	vertexInputInfo.vertexAttributeDescriptionCount =
@@ -1712,25 +3407,23 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
 	// Lesson 19
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float) BP->swapChainExtent.width;
-	viewport.height = (float) BP->swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	
-	VkRect2D scissor{};
-	scissor.offset = {0, 0};
-	scissor.extent = BP->swapChainExtent;
-	
+	// Viewport and scissor are set when the command buffer is recorded
 	VkPipelineViewportStateCreateInfo viewportState{};
 	viewportState.sType =
 			VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
+
+	std::array<VkDynamicState, 2> dynamicStates = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+	dynamicState.pDynamicStates = dynamicStates.data();
 	
 	VkPipelineRasterizationStateCreateInfo rasterizer{};
 	rasterizer.sType =
@@ -1739,7 +3432,7 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	rasterizer.rasterizerDiscardEnable = VK_FALSE;
 	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
 	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizer.cullMode = state.cullMode;
 	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	rasterizer.depthBiasEnable = VK_FALSE;
 	rasterizer.depthBiasConstantFactor = 0.0f; // Optional
@@ -1775,6 +3468,14 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 			VK_BLEND_FACTOR_ZERO; // Optional
 	colorBlendAttachment.alphaBlendOp =
 			VK_BLEND_OP_ADD; // Optional
+	if (state.alphaBlend) {
+		// over the image: straight alpha, the destination alpha is kept
+		colorBlendAttachment.blendEnable = VK_TRUE;
+		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	}
 
 	VkPipelineColorBlendStateCreateInfo colorBlending{};
 	colorBlending.sType =
@@ -1794,27 +3495,14 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 		DSL[i] = D[i]->descriptorSetLayout;
 	}
 	
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType =
-		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = DSL.size();
-	pipelineLayoutInfo.pSetLayouts = DSL.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
-	
-	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
-				&pipelineLayout);
-	if (result != VK_SUCCESS) {
-	 	PrintVkError(result);
-		throw std::runtime_error("failed to create pipeline layout!");
-	}
+	pipelineLayout = BP->layoutCache.acquirePipelineLayout(DSL, PC);
 	
 	// Lesson 19
 	VkPipelineDepthStencilStateCreateInfo depthStencil{};
 	depthStencil.sType = 
 			VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-	depthStencil.depthTestEnable = VK_TRUE;
-	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthTestEnable = state.depthTest ? VK_TRUE : VK_FALSE;
+	depthStencil.depthWriteEnable = state.depthTest ? VK_TRUE : VK_FALSE;
 	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
 	depthStencil.depthBoundsTestEnable = VK_FALSE;
 	depthStencil.minDepthBounds = 0.0f; // Optional
@@ -1835,19 +3523,25 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // Optional
+	pipelineInfo.pDynamicState = &dynamicState;
 	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = BP->renderPass;
+	pipelineInfo.renderPass = state.renderPass != VK_NULL_HANDLE ?
+							  state.renderPass : BP->renderPass;
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 	pipelineInfo.basePipelineIndex = -1; // Optional
 	
-	result = vkCreateGraphicsPipelines(BP->device, VK_NULL_HANDLE, 1,
+	auto start = std::chrono::high_resolution_clock::now();
+	VkResult result = vkCreateGraphicsPipelines(BP->device, BP->pipelineCache, 1,
 			&pipelineInfo, nullptr, &graphicsPipeline);
 	if (result != VK_SUCCESS) {
 	 	PrintVkError(result);
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Pipeline " << VertShader << " + " << FragShader << ": " <<
+		std::chrono::duration<float, std::milli>(end - start).count() << " ms (" <<
+		(BP->pipelineCacheWarm ? "warm" : "cold") << " cache)\n";
 	
 	vkDestroyShaderModule(BP->device, fragShaderModule, nullptr);
 	vkDestroyShaderModule(BP->device, vertShaderModule, nullptr);
@@ -1892,7 +3586,56 @@ VkShaderModule Pipeline::createShaderModule(const std::vector<char>& code) {
 
 void Pipeline::cleanup() {
 		vkDestroyPipeline(BP->device, graphicsPipeline, nullptr);
-		vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
+		BP->layoutCache.releasePipelineLayout(pipelineLayout);
+}
+
+void ComputePipeline::init(BaseProject *bp, const std::string& CompShader,
+						   std::vector<DescriptorSetLayout *> D,
+						   std::vector<VkPushConstantRange> PC) {
+	BP = bp;
+
+	auto compShaderCode = Pipeline::readFile(CompShader);
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = compShaderCode.size();
+	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(compShaderCode.data());
+
+	VkShaderModule compShaderModule;
+	VkResult result = vkCreateShaderModule(BP->device, &moduleInfo, nullptr,
+					&compShaderModule);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create shader module!");
+	}
+
+	std::vector<VkDescriptorSetLayout> DSL(D.size());
+	for(int i = 0; i < D.size(); i++) {
+		DSL[i] = D[i]->descriptorSetLayout;
+	}
+	pipelineLayout = BP->layoutCache.acquirePipelineLayout(DSL, PC);
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = compShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+
+	result = vkCreateComputePipelines(BP->device, BP->pipelineCache, 1,
+			&pipelineInfo, nullptr, &pipeline);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+
+	vkDestroyShaderModule(BP->device, compShaderModule, nullptr);
+}
+
+void ComputePipeline::cleanup() {
+		vkDestroyPipeline(BP->device, pipeline, nullptr);
+		BP->layoutCache.releasePipelineLayout(pipelineLayout);
 }
 
 void DescriptorSetLayout::init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B) {
@@ -1908,26 +3651,45 @@ void DescriptorSetLayout::init(BaseProject *bp, std::vector<DescriptorSetLayoutB
 		bindings[i].pImmutableSamplers = nullptr;
 	}
 	
-	VkDescriptorSetLayoutCreateInfo layoutInfo{};
-	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());;
-	layoutInfo.pBindings = bindings.data();
-	
-	VkResult result = vkCreateDescriptorSetLayout(BP->device, &layoutInfo,
-								nullptr, &descriptorSetLayout);
+	descriptorSetLayout = BP->layoutCache.acquireSetLayout(bindings);
+
+	// Update template: entry i reads the i-th DescriptorInfo of the data
+	layoutBindings = B;
+	std::vector<VkDescriptorUpdateTemplateEntry> entries(B.size());
+	for(int i = 0; i < B.size(); i++) {
+		entries[i].dstBinding = B[i].binding;
+		entries[i].dstArrayElement = 0;
+		entries[i].descriptorCount = 1;
+		entries[i].descriptorType = B[i].type;
+		entries[i].offset = i * sizeof(DescriptorInfo);
+		entries[i].stride = sizeof(DescriptorInfo);
+	}
+
+	VkDescriptorUpdateTemplateCreateInfo templateInfo{};
+	templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+	templateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+	templateInfo.pDescriptorUpdateEntries = entries.data();
+	templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+	templateInfo.descriptorSetLayout = descriptorSetLayout;
+
+	VkResult result = vkCreateDescriptorUpdateTemplate(BP->device, &templateInfo,
+								nullptr, &updateTemplate);
 	if (result != VK_SUCCESS) {
 		PrintVkError(result);
-		throw std::runtime_error("failed to create descriptor set layout!");
+		throw std::runtime_error("failed to create descriptor update template!");
 	}
 }
 
 void DescriptorSetLayout::cleanup() {
-    	vkDestroyDescriptorSetLayout(BP->device, descriptorSetLayout, nullptr);	
+    	vkDestroyDescriptorUpdateTemplate(BP->device, updateTemplate, nullptr);
+    	BP->layoutCache.releaseSetLayout(descriptorSetLayout);
 }
 
 void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 						 std::vector<DescriptorSetElement> E) {
 	BP = bp;
+	layout = DSL;
+	elements = E;
 	
 	// Create uniform buffer
 	uniformBuffers.resize(E.size());
@@ -1935,12 +3697,15 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	toFree.resize(E.size());
 
 	for (int j = 0; j < E.size(); j++) {
-		uniformBuffers[j].resize(BP->swapChainImages.size());
-		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
-		if(E[j].type == UNIFORM) {
-			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+		uniformBuffers[j].resize(MAX_FRAMES_IN_FLIGHT);
+		uniformBuffersMemory[j].resize(MAX_FRAMES_IN_FLIGHT);
+		if(E[j].type == UNIFORM || E[j].type == STORAGE) {
+			VkBufferUsageFlags usage = (E[j].type == UNIFORM) ?
+										VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT :
+										VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+			for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 				VkDeviceSize bufferSize = E[j].size;
-				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				BP->createBuffer(bufferSize, usage,
 									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 									 	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
@@ -1952,69 +3717,2053 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	}
 	
 	// Create Descriptor set
-	std::vector<VkDescriptorSetLayout> layouts(BP->swapChainImages.size(),
-											   DSL->descriptorSetLayout);
-	VkDescriptorSetAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = BP->descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(BP->swapChainImages.size());
-	allocInfo.pSetLayouts = layouts.data();
+	BP->descriptorAllocator.allocate(*DSL, MAX_FRAMES_IN_FLIGHT, descriptorSets);
 	
-	descriptorSets.resize(BP->swapChainImages.size());
-	
-	VkResult result = vkAllocateDescriptorSets(BP->device, &allocInfo,
-										descriptorSets.data());
-	if (result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to allocate descriptor sets!");
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		updateWithTemplate(descriptorSets[i], i);
 	}
-	
-	for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
-		std::vector<VkWriteDescriptorSet> descriptorWrites(E.size());
-		for (int j = 0; j < E.size(); j++) {
-			if(E[j].type == UNIFORM) {
-				VkDescriptorBufferInfo bufferInfo{};
-				bufferInfo.buffer = uniformBuffers[j][i];
-				bufferInfo.offset = 0;
-				bufferInfo.range = E[j].size;
-				
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = E[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				descriptorWrites[j].descriptorCount = 1;
-				descriptorWrites[j].pBufferInfo = &bufferInfo;
-			} else if(E[j].type == TEXTURE) {
-				VkDescriptorImageInfo imageInfo{};
-				imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				imageInfo.imageView = E[j].tex->textureImageView;
-				imageInfo.sampler = E[j].tex->textureSampler;
-		
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = E[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType =
-											VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				descriptorWrites[j].descriptorCount = 1;
-				descriptorWrites[j].pImageInfo = &imageInfo;
+}
+
+// Packs the infos in the order of the bindings of the layout, and writes
+// the whole set with one call
+void DescriptorSet::updateWithTemplate(VkDescriptorSet set, size_t i) {
+	std::vector<DescriptorInfo> data(layout->layoutBindings.size());
+	for (int k = 0; k < layout->layoutBindings.size(); k++) {
+		for (int j = 0; j < elements.size(); j++) {
+			if(elements[j].binding != layout->layoutBindings[k].binding) {
+				continue;
 			}
-		}		
-		vkUpdateDescriptorSets(BP->device,
-						static_cast<uint32_t>(descriptorWrites.size()),
-						descriptorWrites.data(), 0, nullptr);
+			if(elements[j].type == UNIFORM || elements[j].type == STORAGE) {
+				data[k].buffer.buffer = uniformBuffers[j][i];
+				data[k].buffer.offset = 0;
+				data[k].buffer.range = elements[j].size;
+			} else if(elements[j].type == TEXTURE) {
+				data[k].image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				data[k].image.imageView = elements[j].tex->textureImageView;
+				data[k].image.sampler = elements[j].tex->textureSampler;
+			}
+		}
 	}
+	vkUpdateDescriptorSetWithTemplate(BP->device, set, layout->updateTemplate,
+						data.data());
+}
+
+// The same update with one VkWriteDescriptorSet per element
+void DescriptorSet::updateWithWrites(VkDescriptorSet set, size_t i) {
+	std::vector<VkWriteDescriptorSet> descriptorWrites(elements.size());
+	// the infos must outlive the loop, they are read by vkUpdateDescriptorSets
+	std::vector<VkDescriptorBufferInfo> bufferInfo(elements.size());
+	std::vector<VkDescriptorImageInfo> imageInfo(elements.size());
+	for (int j = 0; j < elements.size(); j++) {
+		descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[j].dstSet = set;
+		descriptorWrites[j].dstBinding = elements[j].binding;
+		descriptorWrites[j].dstArrayElement = 0;
+		descriptorWrites[j].descriptorCount = 1;
+		if(elements[j].type == UNIFORM || elements[j].type == STORAGE) {
+			bufferInfo[j].buffer = uniformBuffers[j][i];
+			bufferInfo[j].offset = 0;
+			bufferInfo[j].range = elements[j].size;
+			
+			descriptorWrites[j].descriptorType = (elements[j].type == UNIFORM) ?
+										VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+										VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].pBufferInfo = &bufferInfo[j];
+		} else if(elements[j].type == TEXTURE) {
+			imageInfo[j].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo[j].imageView = elements[j].tex->textureImageView;
+			imageInfo[j].sampler = elements[j].tex->textureSampler;
+	
+			descriptorWrites[j].descriptorType =
+										VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[j].pImageInfo = &imageInfo[j];
+		}
+	}		
+	vkUpdateDescriptorSets(BP->device,
+					static_cast<uint32_t>(descriptorWrites.size()),
+					descriptorWrites.data(), 0, nullptr);
+}
 
+// Allocates and writes count sets with vkUpdateDescriptorSets, then again
+// with the update template, and prints the times
+void DescriptorSet::benchmarkUpdates(int count) {
+	DescriptorAllocator allocator;
+	allocator.init(BP, 1024);
+	std::vector<VkDescriptorSet> sets;
+
+	for(int pass = 0; pass < 2; pass++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		allocator.allocate(*layout, static_cast<uint32_t>(count), sets);
+		auto allocated = std::chrono::high_resolution_clock::now();
+		for(int n = 0; n < count; n++) {
+			if(pass == 0) {
+				updateWithWrites(sets[n], 0);
+			} else {
+				updateWithTemplate(sets[n], 0);
+			}
+		}
+		auto updated = std::chrono::high_resolution_clock::now();
+
+		std::cout << count << " descriptor sets, " <<
+			(pass == 0 ? "vkUpdateDescriptorSets" : "update template") <<
+			": allocation " <<
+			std::chrono::duration<float, std::milli>(allocated - start).count() <<
+			" ms, update " <<
+			std::chrono::duration<float, std::milli>(updated - allocated).count() <<
+			" ms\n";
+		allocator.resetPools();
+	}
+	allocator.cleanup();
 }
 
 void DescriptorSet::cleanup() {
 	for(int j = 0; j < uniformBuffers.size(); j++) {
 		if(toFree[j]) {
-			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+			for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
 				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
 			}
 		}
 	}
+}
+
+void DescriptorAllocator::init(BaseProject *bp, uint32_t sets) {
+	BP = bp;
+	setsPerPool = sets;
+	// at least one descriptor of each type per set
+	descriptorsPerSet = {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+						 {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+						 {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
+}
+
+// A recycled pool if any, otherwise a new one
+VkDescriptorPool DescriptorAllocator::grabPool() {
+	if(freePools.empty()) {
+		return createPool();
+	}
+	VkDescriptorPool pool = freePools.back();
+	freePools.pop_back();
+	usedPools.push_back(pool);
+	return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::createPool() {
+	std::vector<VkDescriptorPoolSize> poolSizes = descriptorsPerSet;
+	for (auto &size : poolSizes) {
+		size.descriptorCount *= setsPerPool;
+	}
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = setsPerPool;
+
+	VkDescriptorPool pool;
+	VkResult result = vkCreateDescriptorPool(BP->device, &poolInfo, nullptr,
+								&pool);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+	usedPools.push_back(pool);
+	return pool;
+}
+
+void DescriptorAllocator::allocate(const DescriptorSetLayout &layout, uint32_t count,
+								   std::vector<VkDescriptorSet> &sets) {
+	// the pools created from now on have room for the descriptors of the layout
+	for (const DescriptorSetLayoutBinding &b : layout.layoutBindings) {
+		uint32_t n = static_cast<uint32_t>(std::count_if(
+			layout.layoutBindings.begin(), layout.layoutBindings.end(),
+			[&b](const DescriptorSetLayoutBinding &o) { return o.type == b.type; }));
+		auto size = std::find_if(descriptorsPerSet.begin(), descriptorsPerSet.end(),
+			[&b](const VkDescriptorPoolSize &s) { return s.type == b.type; });
+		if (size == descriptorsPerSet.end()) {
+			descriptorsPerSet.push_back({b.type, n});
+		} else {
+			size->descriptorCount = std::max(size->descriptorCount, n);
+		}
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(count, layout.descriptorSetLayout);
+	sets.resize(layouts.size());
+
+	// a single call cannot take more sets than a pool holds
+	for(size_t first = 0; first < layouts.size(); first += setsPerPool) {
+		uint32_t count = static_cast<uint32_t>(
+						std::min<size_t>(setsPerPool, layouts.size() - first));
+
+		if(currentPool == VK_NULL_HANDLE) {
+			currentPool = grabPool();
+		}
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = currentPool;
+		allocInfo.descriptorSetCount = count;
+		allocInfo.pSetLayouts = layouts.data() + first;
+
+		VkResult result = vkAllocateDescriptorSets(BP->device, &allocInfo,
+									sets.data() + first);
+		if(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+			// the current pool is full, or older than the layout: retry once
+			// with a new one, which fits count sets of the layout
+			currentPool = createPool();
+			allocInfo.descriptorPool = currentPool;
+			result = vkAllocateDescriptorSets(BP->device, &allocInfo,
+									sets.data() + first);
+		}
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to allocate descriptor sets!");
+		}
+		allocatedSets += count;
+	}
+}
+
+void DescriptorAllocator::resetPools() {
+	for(VkDescriptorPool pool : usedPools) {
+		vkResetDescriptorPool(BP->device, pool, 0);
+		freePools.push_back(pool);
+	}
+	usedPools.clear();
+	currentPool = VK_NULL_HANDLE;
+	allocatedSets = 0;
+}
+
+void DescriptorAllocator::printUsage(const std::string &name) {
+	std::cout << name << ": " << allocatedSets << " sets in " <<
+		usedPools.size() << " pools of " << setsPerPool << " (" <<
+		freePools.size() << " free pools)\n";
+}
+
+void DescriptorAllocator::cleanup() {
+	for(VkDescriptorPool pool : usedPools) {
+		vkDestroyDescriptorPool(BP->device, pool, nullptr);
+	}
+	for(VkDescriptorPool pool : freePools) {
+		vkDestroyDescriptorPool(BP->device, pool, nullptr);
+	}
+	usedPools.clear();
+	freePools.clear();
+	currentPool = VK_NULL_HANDLE;
+}
+
+// Non-dispatchable handles are pointers or 64 bit integers, depending on the platform
+template <class H>
+static uint64_t handleKey(H handle) {
+	uint64_t k = 0;
+	memcpy(&k, &handle, sizeof(handle));
+	return k;
+}
+
+size_t LayoutCache::KeyHash::operator()(const Key &k) const {
+	// FNV-1a on the words of the key
+	uint64_t h = 14695981039346656037ULL;
+	for(uint64_t v : k) {
+		h ^= v;
+		h *= 1099511628211ULL;
+	}
+	return static_cast<size_t>(h);
+}
+
+void LayoutCache::init(BaseProject *bp) {
+	BP = bp;
+}
+
+VkDescriptorSetLayout LayoutCache::acquireSetLayout(
+			std::vector<VkDescriptorSetLayoutBinding> bindings) {
+	// the order in which the bindings are listed does not matter
+	std::sort(bindings.begin(), bindings.end(),
+		[](const VkDescriptorSetLayoutBinding &a, const VkDescriptorSetLayoutBinding &b) {
+			return a.binding < b.binding;
+		});
+
+	Key key;
+	for(const auto &b : bindings) {
+		key.push_back(b.binding);
+		key.push_back(b.descriptorType);
+		key.push_back(b.descriptorCount);
+		key.push_back(b.stageFlags);
+	}
+
+	auto it = setLayouts.find(key);
+	if(it != setLayouts.end()) {
+		it->second.refCount++;
+		reused++;
+		return it->second.handle;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());;
+	layoutInfo.pBindings = bindings.data();
+	
+	VkDescriptorSetLayout layout;
+	VkResult result = vkCreateDescriptorSetLayout(BP->device, &layoutInfo,
+								nullptr, &layout);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create descriptor set layout!");
+	}
+	setLayouts[key] = {layout, 1};
+	created++;
+	return layout;
+}
+
+void LayoutCache::releaseSetLayout(VkDescriptorSetLayout layout) {
+	for(auto it = setLayouts.begin(); it != setLayouts.end(); it++) {
+		if(it->second.handle == layout) {
+			if(--it->second.refCount == 0) {
+				vkDestroyDescriptorSetLayout(BP->device, layout, nullptr);
+				setLayouts.erase(it);
+			}
+			return;
+		}
+	}
+}
+
+VkPipelineLayout LayoutCache::acquirePipelineLayout(
+			const std::vector<VkDescriptorSetLayout> &DSL,
+			const std::vector<VkPushConstantRange> &PC) {
+	Key key;
+	key.push_back(DSL.size());
+	for(VkDescriptorSetLayout l : DSL) {
+		key.push_back(handleKey(l));
+	}
+	for(const auto &r : PC) {
+		key.push_back(r.stageFlags);
+		key.push_back(r.offset);
+		key.push_back(r.size);
+	}
+
+	auto it = pipelineLayouts.find(key);
+	if(it != pipelineLayouts.end()) {
+		it->second.refCount++;
+		reused++;
+		return it->second.handle;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType =
+		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(DSL.size());
+	pipelineLayoutInfo.pSetLayouts = DSL.data();
+	pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(PC.size());
+	pipelineLayoutInfo.pPushConstantRanges = PC.data();
+	
+	VkPipelineLayout layout;
+	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
+				&layout);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+	pipelineLayouts[key] = {layout, 1};
+	created++;
+	return layout;
+}
+
+void LayoutCache::releasePipelineLayout(VkPipelineLayout layout) {
+	for(auto it = pipelineLayouts.begin(); it != pipelineLayouts.end(); it++) {
+		if(it->second.handle == layout) {
+			if(--it->second.refCount == 0) {
+				vkDestroyPipelineLayout(BP->device, layout, nullptr);
+				pipelineLayouts.erase(it);
+			}
+			return;
+		}
+	}
+}
+
+void LayoutCache::cleanup() {
+	// layouts that were never released
+	for(auto &e : pipelineLayouts) {
+		vkDestroyPipelineLayout(BP->device, e.second.handle, nullptr);
+	}
+	for(auto &e : setLayouts) {
+		vkDestroyDescriptorSetLayout(BP->device, e.second.handle, nullptr);
+	}
+	pipelineLayouts.clear();
+	setLayouts.clear();
+}
+
+void RecordWorkers::init(BaseProject *bp, uint32_t workerCount) {
+	BP = bp;
+
+	QueueFamilyIndices queueFamilyIndices = BP->findQueueFamilies(BP->physicalDevice);
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	pools.resize(MAX_FRAMES_IN_FLIGHT);
+	buffers.resize(MAX_FRAMES_IN_FLIGHT);
+	for (size_t f = 0; f < MAX_FRAMES_IN_FLIGHT; f++) {
+		pools[f].resize(workerCount);
+		buffers[f].resize(workerCount);
+		for (uint32_t w = 0; w < workerCount; w++) {
+			VkResult result = vkCreateCommandPool(BP->device, &poolInfo, nullptr,
+						&pools[f][w]);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to create command pool!");
+			}
+		}
+	}
+
+	for (uint32_t w = 0; w < workerCount; w++) {
+		threads.emplace_back(&RecordWorkers::workerLoop, this, w);
+	}
+}
+
+// The pools of the frame are reset (the frame slot is free), then the
+// workers are woken up and waited for
+const std::vector<VkCommandBuffer> &RecordWorkers::record(uint32_t f,
+							uint32_t jobs, VkFramebuffer framebuffer) {
+	for (auto pool : pools[f]) {
+		vkResetCommandPool(BP->device, pool, 0);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frame = f;
+		jobCount = jobs;
+		inheritance = {};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.renderPass = BP->renderPass;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = framebuffer;
+		recorded.assign(jobs, VK_NULL_HANDLE);
+		pending = static_cast<uint32_t>(threads.size());
+		generation++;
+	}
+	startCondition.notify_all();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return pending == 0; });
+	if (error) {
+		std::exception_ptr e = error;
+		error = nullptr;
+		std::rethrow_exception(e);
+	}
+	return recorded;
+}
+
+void RecordWorkers::workerLoop(uint32_t worker) {
+	uint64_t seen = 0;
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			startCondition.wait(lock, [&] { return quit || generation != seen; });
+			if (quit) {
+				return;
+			}
+			seen = generation;
+		}
+
+		// an exception can't leave the thread: it is kept for record
+		std::exception_ptr thrown;
+		try {
+			uint32_t used = 0;
+			for (uint32_t job = worker; job < jobCount; job += static_cast<uint32_t>(threads.size())) {
+				VkCommandBuffer commandBuffer = getBuffer(worker, used++);
+
+				VkCommandBufferBeginInfo beginInfo{};
+				beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+								  VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+				beginInfo.pInheritanceInfo = &inheritance;
+				if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+					throw std::runtime_error("failed to begin recording command buffer!");
+				}
+
+				// the dynamic states are not inherited from the primary
+				BP->setViewportAndScissor(commandBuffer);
+				BP->recordJob(job, commandBuffer, frame);
+
+				if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+					throw std::runtime_error("failed to record command buffer!");
+				}
+				recorded[job] = commandBuffer;
+			}
+		} catch (...) {
+			thrown = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (thrown && !error) {
+				error = thrown;
+			}
+			if (--pending == 0) {
+				doneCondition.notify_one();
+			}
+		}
+	}
+}
+
+// The i-th secondary command buffer of the worker in the current frame,
+// allocated the first time it is needed
+VkCommandBuffer RecordWorkers::getBuffer(uint32_t worker, uint32_t i) {
+	std::vector<VkCommandBuffer> &list = buffers[frame][worker];
+	if (i >= list.size()) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = pools[frame][worker];
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		VkResult result = vkAllocateCommandBuffers(BP->device, &allocInfo, &commandBuffer);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
+		list.push_back(commandBuffer);
+	}
+	return list[i];
+}
+
+void RecordWorkers::cleanup() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	startCondition.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+
+	// the command buffers are freed with their pools
+	for (auto &framePools : pools) {
+		for (auto pool : framePools) {
+			vkDestroyCommandPool(BP->device, pool, nullptr);
+		}
+	}
+}
+
+void PresentTimer::init(BaseProject *bp, PFN_vkWaitForPresentKHR wait) {
+	BP = bp;
+	waitForPresent = wait;
+	thread = std::thread(&PresentTimer::threadLoop, this);
+}
+
+// The frame is queued before the present, so the thread can't miss it
+VkResult PresentTimer::present(VkQueue queue, VkPresentInfoKHR &presentInfo,
+				uint64_t presentId, std::chrono::steady_clock::time_point submitTime) {
+	VkPresentIdKHR presentIdInfo{};
+	presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+	presentIdInfo.pNext = presentInfo.pNext;
+	presentIdInfo.swapchainCount = 1;
+	presentIdInfo.pPresentIds = &presentId;
+	presentInfo.pNext = &presentIdInfo;
+
+	VkResult result;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back({presentInfo.pSwapchains[0], presentId, submitTime});
+		result = vkQueuePresentKHR(queue, &presentInfo);
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+			pending.pop_back();
+		}
+	}
+	condition.notify_one();
+	presentInfo.pNext = presentIdInfo.pNext;
+	return result;
+}
+
+// The swap chain is being replaced: its frames are no longer waited for
+void PresentTimer::forget(VkSwapchainKHR swapChain) {
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.erase(std::remove_if(pending.begin(), pending.end(),
+					[&](const Pending &p) { return p.swapChain == swapChain; }),
+				  pending.end());
+}
+
+// The frames are shown in present order: the oldest one is polled, and the
+// mutex is released between two polls for the presents of the render thread
+void PresentTimer::threadLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true) {
+		condition.wait(lock, [&] { return quit || !pending.empty(); });
+		if (quit) {
+			return;
+		}
+
+		Pending next = pending.front();
+		VkResult result = waitForPresent(BP->device, next.swapChain, next.presentId, 0);
+		if (result == VK_TIMEOUT) {
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::microseconds(250));
+			lock.lock();
+			continue;
+		}
+
+		pending.pop_front();
+		// a frame of a swap chain out of date is not timed
+		if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+			submitToPresent = std::chrono::duration<float, std::milli>(
+				std::chrono::steady_clock::now() - next.submitTime).count();
+		}
+	}
+}
+
+void PresentTimer::cleanup() {
+	if (!thread.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	condition.notify_one();
+	thread.join();
+	pending.clear();
+}
+
+void DrawList::init(BaseProject *bp, uint32_t draws, uint32_t maxGroupCount) {
+	BP = bp;
+	maxDraws = draws;
+	maxGroups = maxGroupCount;
+
+	// large enough for the commands and counts, or for the CullObjects
+	VkDeviceSize size = std::max(countOffset(maxGroups),
+								 VkDeviceSize(maxDraws * sizeof(CullObject)));
+	buffers.resize(MAX_FRAMES_IN_FLIGHT);
+	buffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	mapped.resize(MAX_FRAMES_IN_FLIGHT);
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		BP->createBuffer(size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+						 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 buffers[i], buffersMemory[i]);
+		// written every frame: mapped once
+		vkMapMemory(BP->device, buffersMemory[i], 0, size, 0, &mapped[i]);
+	}
+}
+
+// D are the sets before the one of the draw list: the shader finds the
+// camera in set 0 and the model matrices (indexed by firstInstance) in set 1.
+// Needs the draw count and the instance offsets, or the culling stays off.
+void DrawList::enableCulling(const std::string& CompShader,
+							 std::vector<DescriptorSetLayout *> D) {
+	if (!BP->drawIndirectCountSupported || !BP->drawIndirectFirstInstanceSupported) {
+		std::cout << "GPU culling: no (draw count not supported)\n";
+		return;
+	}
+
+	cullLayout.init(BP, {
+		{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+		{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+		{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT}
+	});
+	D.push_back(&cullLayout);
+	cullPipeline.init(BP, CompShader, D,
+				{{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t)}});
+
+	// written and read only by the GPU
+	VkDeviceSize culledSize = maxDraws * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize countSize = maxGroups * sizeof(uint32_t);
+	culledBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	culledBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	countBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	countBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	countReadbacks.resize(MAX_FRAMES_IN_FLIGHT);
+	countReadbacksMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	countReadbacksMapped.resize(MAX_FRAMES_IN_FLIGHT);
+	readbackGroups.assign(MAX_FRAMES_IN_FLIGHT, 0);
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		BP->createBuffer(culledSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+						 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+						 culledBuffers[i], culledBuffersMemory[i]);
+		BP->createBuffer(countSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+						 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+						 VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+						 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+						 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+						 countBuffers[i], countBuffersMemory[i]);
+		BP->createBuffer(countSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 countReadbacks[i], countReadbacksMemory[i]);
+		vkMapMemory(BP->device, countReadbacksMemory[i], 0, countSize, 0,
+					&countReadbacksMapped[i]);
+	}
+
+	BP->descriptorAllocator.allocate(cullLayout, MAX_FRAMES_IN_FLIGHT, cullSets);
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		std::array<VkDescriptorBufferInfo, 3> bufferInfo{};
+		bufferInfo[0] = {buffers[i], 0, maxDraws * sizeof(CullObject)};
+		bufferInfo[1] = {culledBuffers[i], 0, culledSize};
+		bufferInfo[2] = {countBuffers[i], 0, countSize};
+
+		std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+		for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = cullSets[i];
+			descriptorWrites[j].dstBinding = j;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pBufferInfo = &bufferInfo[j];
+		}
+		vkUpdateDescriptorSets(BP->device,
+					static_cast<uint32_t>(descriptorWrites.size()),
+					descriptorWrites.data(), 0, nullptr);
+	}
+
+	gpuCulling = true;
+	std::cout << "GPU culling: yes\n";
+}
+
+void DrawList::begin() {
+	groups.clear();
+	drawCount = 0;
+}
+
+void DrawList::add(Model &model, DescriptorSet *ds, uint32_t firstInstance,
+				   uint32_t instanceCount) {
+	if (drawCount == maxDraws) {
+		throw std::runtime_error("too many draws in the draw list!");
+	}
+
+	Group *group = nullptr;
+	for (auto &g : groups) {
+		if (g.model == &model && g.ds == ds) {
+			group = &g;
+			break;
+		}
+	}
+	if (group == nullptr) {
+		if (groups.size() == maxGroups) {
+			throw std::runtime_error("too many groups in the draw list!");
+		}
+		groups.push_back({&model, ds, 0, {}});
+		group = &groups.back();
+	}
+
+	VkDrawIndexedIndirectCommand command{};
+	command.indexCount = static_cast<uint32_t>(model.indices.size());
+	command.instanceCount = instanceCount;
+	command.firstIndex = 0;
+	command.vertexOffset = 0;
+	command.firstInstance = firstInstance;
+	group->commands.push_back(command);
+	drawCount++;
+}
+
+VkDeviceSize DrawList::countOffset(uint32_t group) {
+	return maxDraws * sizeof(VkDrawIndexedIndirectCommand) + group * sizeof(uint32_t);
+}
+
+// The commands of each group are packed one after the other: as they are,
+// or as CullObjects for the compute shader
+void DrawList::upload(uint32_t frame) {
+	if (gpuCulling) {
+		// the last frame that used this slot is complete
+		const uint32_t *counts = static_cast<const uint32_t *>(countReadbacksMapped[frame]);
+		culledVisible = 0;
+		for (uint32_t i = 0; i < readbackGroups[frame]; i++) {
+			culledVisible += counts[i];
+		}
+		readbackGroups[frame] = static_cast<uint32_t>(groups.size());
+
+		CullObject *objects = static_cast<CullObject *>(mapped[frame]);
+		uint32_t first = 0;
+		for (uint32_t i = 0; i < groups.size(); i++) {
+			Group &g = groups[i];
+			g.firstCommand = first;
+			for (const auto &c : g.commands) {
+				objects->command = c;
+				objects->group = i;
+				objects->firstCommand = first;
+				objects->boundingSphere = g.model->boundingSphere;
+				objects++;
+			}
+			first += static_cast<uint32_t>(g.commands.size());
+		}
+		BP->frameStats.uploadBytes += first * sizeof(CullObject);
+		return;
+	}
+
+	char *data = static_cast<char *>(mapped[frame]);
+	VkDrawIndexedIndirectCommand *commands =
+		reinterpret_cast<VkDrawIndexedIndirectCommand *>(data);
+	uint32_t *counts = reinterpret_cast<uint32_t *>(data + countOffset(0));
+
+	uint32_t first = 0;
+	for (size_t i = 0; i < groups.size(); i++) {
+		Group &g = groups[i];
+		g.firstCommand = first;
+		memcpy(commands + first, g.commands.data(),
+			   g.commands.size() * sizeof(VkDrawIndexedIndirectCommand));
+		counts[i] = static_cast<uint32_t>(g.commands.size());
+		first += counts[i];
+	}
+	BP->frameStats.uploadBytes += first * sizeof(VkDrawIndexedIndirectCommand) +
+								  static_cast<uint32_t>(groups.size() * sizeof(uint32_t));
+}
+
+// Zeroes the counts, then one invocation per draw appends the visible ones
+// to their group. Recorded before the render pass that draws the list.
+void DrawList::recordCulling(VkCommandBuffer commandBuffer, uint32_t frame,
+							 const std::vector<VkDescriptorSet> &sets) {
+	if (!gpuCulling || drawCount == 0) {
+		return;
+	}
+
+	vkCmdFillBuffer(commandBuffer, countBuffers[frame], 0, VK_WHOLE_SIZE, 0);
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = countBuffers[frame];
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+						 0, nullptr, 1, &barrier, 0, nullptr);
+
+	std::vector<VkDescriptorSet> allSets = sets;
+	allSets.push_back(cullSets[frame]);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+					  cullPipeline.pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+					cullPipeline.pipelineLayout, 0,
+					static_cast<uint32_t>(allSets.size()), allSets.data(), 0, nullptr);
+	vkCmdPushConstants(commandBuffer, cullPipeline.pipelineLayout,
+					   VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &drawCount);
+	// local_size_x of the shader is 64
+	vkCmdDispatch(commandBuffer, (drawCount + 63) / 64, 1, 1);
+
+	std::array<VkBufferMemoryBarrier, 2> barriers{barrier, barrier};
+	for (auto &b : barriers) {
+		b.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		b.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	}
+	barriers[0].dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[1].buffer = culledBuffers[frame];
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+						 0, nullptr, static_cast<uint32_t>(barriers.size()),
+						 barriers.data(), 0, nullptr);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.size = groups.size() * sizeof(uint32_t);
+	vkCmdCopyBuffer(commandBuffer, countBuffers[frame], countReadbacks[frame],
+					1, &copyRegion);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.buffer = countReadbacks[frame];
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_HOST_BIT, 0,
+						 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// The buffers of the model of the group must be bound
+void DrawList::record(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t group) {
+	const Group &g = groups[group];
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	const uint32_t count = static_cast<uint32_t>(g.commands.size());
+	VkDeviceSize offset = g.firstCommand * sizeof(VkDrawIndexedIndirectCommand);
+
+	if (gpuCulling) {
+		BP->cmdDrawIndexedIndirectCount(commandBuffer, culledBuffers[frame], offset,
+							countBuffers[frame], group * sizeof(uint32_t), count, stride);
+		BP->drawCalls++;
+	} else if (!BP->drawIndirectFirstInstanceSupported) {
+		for (const auto &c : g.commands) {
+			vkCmdDrawIndexed(commandBuffer, c.indexCount, c.instanceCount,
+							 c.firstIndex, c.vertexOffset, c.firstInstance);
+		}
+		BP->drawCalls += count;
+	} else if (BP->drawIndirectCountSupported) {
+		BP->cmdDrawIndexedIndirectCount(commandBuffer, buffers[frame], offset,
+							buffers[frame], countOffset(group), count, stride);
+		BP->drawCalls++;
+	} else if (BP->multiDrawIndirectSupported) {
+		vkCmdDrawIndexedIndirect(commandBuffer, buffers[frame], offset, count, stride);
+		BP->drawCalls++;
+	} else {
+		for (uint32_t i = 0; i < count; i++) {
+			vkCmdDrawIndexedIndirect(commandBuffer, buffers[frame],
+									 offset + i * stride, 1, stride);
+		}
+		BP->drawCalls += count;
+	}
+}
+
+void DrawList::cleanup() {
+	for (size_t i = 0; i < buffers.size(); i++) {
+		vkUnmapMemory(BP->device, buffersMemory[i]);
+		vkDestroyBuffer(BP->device, buffers[i], nullptr);
+		vkFreeMemory(BP->device, buffersMemory[i], nullptr);
+	}
+	if (gpuCulling) {
+		for (size_t i = 0; i < culledBuffers.size(); i++) {
+			vkDestroyBuffer(BP->device, culledBuffers[i], nullptr);
+			vkFreeMemory(BP->device, culledBuffersMemory[i], nullptr);
+			vkDestroyBuffer(BP->device, countBuffers[i], nullptr);
+			vkFreeMemory(BP->device, countBuffersMemory[i], nullptr);
+			vkUnmapMemory(BP->device, countReadbacksMemory[i]);
+			vkDestroyBuffer(BP->device, countReadbacks[i], nullptr);
+			vkFreeMemory(BP->device, countReadbacksMemory[i], nullptr);
+		}
+		cullPipeline.cleanup();
+		cullLayout.cleanup();
+	}
+}
+
+void RenderQueue::init(BaseProject *bp) {
+	BP = bp;
+}
+
+void RenderQueue::clear() {
+	items.clear();
+}
+
+uint32_t RenderQueue::idOf(const void *object) {
+	auto it = ids.find(object);
+	if (it != ids.end()) {
+		return it->second;
+	}
+	uint32_t id = static_cast<uint32_t>(ids.size());
+	ids[object] = id;
+	return id;
+}
+
+// Key: pass (4 bits), pipeline (8), mesh (12), material (16), depth (24).
+// depth goes from 0 (near) to 1 (far): the draws of a state are front to back
+void RenderQueue::add(uint32_t pass, Pipeline &pipeline, Model &mesh,
+					  DescriptorSet *material, float depth, uint32_t payload) {
+	const uint64_t depthMask = (1ull << 24) - 1;
+	uint64_t key = (uint64_t(pass) & 0xF) << 60 |
+				   (uint64_t(idOf(&pipeline)) & 0xFF) << 52 |
+				   (uint64_t(idOf(&mesh)) & 0xFFF) << 40 |
+				   (uint64_t(material ? idOf(material) + 1 : 0) & 0xFFFF) << 24 |
+				   static_cast<uint64_t>(glm::clamp(depth, 0.0f, 1.0f) * depthMask);
+	items.push_back({key, &pipeline, &mesh, material, payload});
+}
+
+// LSD radix sort, one byte of the key per pass. The passes where all the
+// keys have the same byte are skipped, most of them in practice.
+void RenderQueue::sort() {
+	if (items.empty()) {
+		return;
+	}
+	sorted.resize(items.size());
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t offsets[257] = {};
+		for (const auto &item : items) {
+			offsets[((item.key >> shift) & 0xFF) + 1]++;
+		}
+		if (offsets[((items[0].key >> shift) & 0xFF) + 1] == items.size()) {
+			continue;
+		}
+		for (int i = 0; i < 256; i++) {
+			offsets[i + 1] += offsets[i];
+		}
+		for (const auto &item : items) {
+			sorted[offsets[(item.key >> shift) & 0xFF]++] = item;
+		}
+		items.swap(sorted);
+	}
+}
+
+// Records items [first, first + count): the state starts unbound, as in a
+// new command buffer
+void RenderQueue::flush(VkCommandBuffer commandBuffer, size_t first, size_t count,
+						const BindSets &bindSets, const BindMaterial &bindMaterial,
+						const Draw &draw) {
+	Pipeline *pipeline = nullptr;
+	Model *mesh = nullptr;
+	DescriptorSet *material = nullptr;
+	// the calls recorded when the current pipeline and material were bound
+	uint32_t pipelineBinds = 0;
+	uint32_t materialBinds = 0;
+	uint32_t issued = 0;
+	uint32_t avoided = 0;
+
+	for (size_t i = first; i < first + count; i++) {
+		const Item &item = items[i];
+
+		if (item.pipeline != pipeline) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+							  item.pipeline->graphicsPipeline);
+			pipelineBinds = 1 + bindSets(commandBuffer, *item.pipeline);
+			pipeline = item.pipeline;
+			material = nullptr;
+			issued += pipelineBinds;
+		} else {
+			avoided += pipelineBinds;
+		}
+
+		if (item.mesh != mesh) {
+			VkBuffer vertexBuffers[] = {item.mesh->vertexBuffer};
+			VkDeviceSize offsets[] = {0};
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, item.mesh->indexBuffer, 0,
+								 VK_INDEX_TYPE_UINT32);
+			mesh = item.mesh;
+			issued += 2;
+		} else {
+			avoided += 2;
+		}
+
+		if (item.material != nullptr) {
+			if (item.material != material) {
+				materialBinds = bindMaterial(commandBuffer, *pipeline, *item.material);
+				material = item.material;
+				issued += materialBinds;
+			} else {
+				avoided += materialBinds;
+			}
+		}
+
+		draw(commandBuffer, item);
+	}
+
+	BP->bindsIssued += issued;
+	BP->bindsAvoided += avoided;
+}
+
+void FrustumCuller::begin(const glm::mat4 &view, const glm::mat4 &proj, float distance) {
+	// The planes are the sums and differences of the rows of proj * view
+	// (depth from 0 to 1): a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+	glm::mat4 m = glm::transpose(proj * view);
+	planes[0] = m[3] + m[0];
+	planes[1] = m[3] - m[0];
+	planes[2] = m[3] + m[1];
+	planes[3] = m[3] - m[1];
+	planes[4] = m[2];
+	planes[5] = m[3] - m[2];
+	eye = glm::vec3(glm::inverse(view)[3]);
+	maxDistance = distance;
+
+	count = 0;
+	visibleCount = 0;
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	radius.clear();
+}
+
+// The box of the model in world space: the center is transformed, the half
+// extents are summed along the absolute axes of the transform
+uint32_t FrustumCuller::add(const Model &model, const glm::mat4 &transform) {
+	glm::vec3 center = glm::vec3(transform *
+							glm::vec4((model.aabbMin + model.aabbMax) * 0.5f, 1.0f));
+	glm::vec3 extent = (model.aabbMax - model.aabbMin) * 0.5f;
+	glm::vec3 worldExtent = glm::abs(glm::vec3(transform[0])) * extent.x +
+							glm::abs(glm::vec3(transform[1])) * extent.y +
+							glm::abs(glm::vec3(transform[2])) * extent.z;
+
+	centerX.push_back(center.x);
+	centerY.push_back(center.y);
+	centerZ.push_back(center.z);
+	extentX.push_back(worldExtent.x);
+	extentY.push_back(worldExtent.y);
+	extentZ.push_back(worldExtent.z);
+	radius.push_back(glm::length(worldExtent));
+	return count++;
+}
+
+void FrustumCuller::cull() {
+	// the arrays are padded to a whole number of SIMD blocks
+	const uint32_t width = 8;
+	size_t padded = (count + width - 1) / width * width;
+	for (auto *a : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius}) {
+		a->resize(padded, 0.0f);
+	}
+	visible.resize(padded);
+
+#if defined(CULLING_SIMD) && defined(__AVX__)
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	for (size_t i = 0; i < padded; i += 8) {
+		__m256 cx = _mm256_loadu_ps(&centerX[i]);
+		__m256 cy = _mm256_loadu_ps(&centerY[i]);
+		__m256 cz = _mm256_loadu_ps(&centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&extentZ[i]);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (const auto &plane : planes) {
+			__m256 px = _mm256_set1_ps(plane.x);
+			__m256 py = _mm256_set1_ps(plane.y);
+			__m256 pz = _mm256_set1_ps(plane.z);
+			// distance of the center, plus the projection of the extents
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, cx), _mm256_mul_ps(py, cy)),
+						_mm256_add_ps(_mm256_mul_ps(pz, cz), _mm256_set1_ps(plane.w)));
+			__m256 r = _mm256_add_ps(_mm256_add_ps(
+						_mm256_mul_ps(_mm256_andnot_ps(signMask, px), ex),
+						_mm256_mul_ps(_mm256_andnot_ps(signMask, py), ey)),
+						_mm256_mul_ps(_mm256_andnot_ps(signMask, pz), ez));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+		}
+		__m256 dx = _mm256_sub_ps(cx, _mm256_set1_ps(eye.x));
+		__m256 dy = _mm256_sub_ps(cy, _mm256_set1_ps(eye.y));
+		__m256 dz = _mm256_sub_ps(cz, _mm256_set1_ps(eye.z));
+		__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+								  _mm256_mul_ps(dz, dz));
+		__m256 limit = _mm256_add_ps(_mm256_loadu_ps(&radius[i]), _mm256_set1_ps(maxDistance));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(d2, _mm256_mul_ps(limit, limit), _CMP_LE_OQ));
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int k = 0; k < 8; k++) {
+			visible[i + k] = (mask >> k) & 1;
+		}
+	}
+#elif defined(CULLING_SIMD)
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	for (size_t i = 0; i < padded; i += 4) {
+		__m128 cx = _mm_loadu_ps(&centerX[i]);
+		__m128 cy = _mm_loadu_ps(&centerY[i]);
+		__m128 cz = _mm_loadu_ps(&centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]);
+		__m128 ey = _mm_loadu_ps(&extentY[i]);
+		__m128 ez = _mm_loadu_ps(&extentZ[i]);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (const auto &plane : planes) {
+			__m128 px = _mm_set1_ps(plane.x);
+			__m128 py = _mm_set1_ps(plane.y);
+			__m128 pz = _mm_set1_ps(plane.z);
+			// distance of the center, plus the projection of the extents
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+						_mm_add_ps(_mm_mul_ps(pz, cz), _mm_set1_ps(plane.w)));
+			__m128 r = _mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(_mm_andnot_ps(signMask, px), ex),
+						_mm_mul_ps(_mm_andnot_ps(signMask, py), ey)),
+						_mm_mul_ps(_mm_andnot_ps(signMask, pz), ez));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+		}
+		__m128 dx = _mm_sub_ps(cx, _mm_set1_ps(eye.x));
+		__m128 dy = _mm_sub_ps(cy, _mm_set1_ps(eye.y));
+		__m128 dz = _mm_sub_ps(cz, _mm_set1_ps(eye.z));
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+							   _mm_mul_ps(dz, dz));
+		__m128 limit = _mm_add_ps(_mm_loadu_ps(&radius[i]), _mm_set1_ps(maxDistance));
+		inside = _mm_and_ps(inside, _mm_cmple_ps(d2, _mm_mul_ps(limit, limit)));
+
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++) {
+			visible[i + k] = (mask >> k) & 1;
+		}
+	}
+#else
+	for (size_t i = 0; i < padded; i++) {
+		bool inside = true;
+		for (const auto &plane : planes) {
+			float d = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] +
+					  plane.w;
+			float r = std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] +
+					  std::abs(plane.z) * extentZ[i];
+			inside = inside && d + r >= 0.0f;
+		}
+		glm::vec3 toEye = glm::vec3(centerX[i], centerY[i], centerZ[i]) - eye;
+		float limit = radius[i] + maxDistance;
+		visible[i] = inside && glm::dot(toEye, toEye) <= limit * limit;
+	}
+#endif
+
+	visibleCount = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		visibleCount += visible[i];
+	}
+}
+
+void RenderGraph::init(BaseProject *bp) {
+	BP = bp;
+}
+
+uint32_t RenderGraph::addImage(const std::string &name, VkFormat format) {
+	Image image;
+	image.name = name;
+	image.format = format;
+	image.imported = false;
+	images.push_back(image);
+	return static_cast<uint32_t>(images.size() - 1);
+}
+
+uint32_t RenderGraph::importImage(const std::string &name, VkFormat format) {
+	uint32_t i = addImage(name, format);
+	images[i].imported = true;
+	return i;
+}
+
+uint32_t RenderGraph::addPass(const Pass &pass) {
+	passes.push_back(pass);
+	return static_cast<uint32_t>(passes.size() - 1);
+}
+
+// The image must be left in the layout of access at the end of the frame
+void RenderGraph::addOutput(uint32_t image, Access access) {
+	outputs.push_back({image, access});
+}
+
+RenderGraph::AccessInfo RenderGraph::accessInfo(Access access) {
+	switch (access) {
+	case COLOR_ATTACHMENT:
+		return {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true};
+	case DEPTH_ATTACHMENT:
+		return {VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+				VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+				VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true};
+	case SAMPLED:
+		return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_USAGE_SAMPLED_BIT, false};
+	case TRANSFER_SRC:
+		return {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false};
+	case TRANSFER_DST:
+		return {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_USAGE_TRANSFER_DST_BIT, true};
+	default:	// PRESENT
+		return {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, false};
+	}
+}
+
+bool RenderGraph::isDepthFormat(VkFormat format) {
+	return format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+		   format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D16_UNORM;
+}
+
+void RenderGraph::compile() {
+	// Backwards: a pass is kept if it has side effects, or if it writes an
+	// image used by the output or by a kept pass after it
+	std::vector<bool> used(images.size(), false);
+	for (const auto &o : outputs) {
+		used[o.image] = true;
+	}
+	for (int p = static_cast<int>(passes.size()) - 1; p >= 0; p--) {
+		Pass &pass = passes[p];
+		bool needed = pass.sideEffects;
+		for (const auto &u : pass.uses) {
+			needed = needed || (accessInfo(u.access).write && used[u.image]);
+		}
+		pass.culled = !needed;
+		if (pass.culled) {
+			std::cout << "Render graph: pass " << pass.name << " culled\n";
+			continue;
+		}
+		// the attachments keep what the passes before wrote
+		for (const auto &u : pass.uses) {
+			used[u.image] = true;
+		}
+	}
+
+	// Forwards: a barrier before each use that changes the layout, or that
+	// follows or is a write. The first use of an image discards its content.
+	struct State {
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags stage = 0;
+		VkAccessFlags access = 0;
+		bool write = false;
+		bool used = false;
+	};
+	std::vector<State> states(images.size());
+	auto transition = [&](uint32_t i, Access access, std::vector<Transition> &transitions) {
+		AccessInfo info = accessInfo(access);
+		Image &image = images[i];
+		State &state = states[i];
+		image.usage |= info.usage;
+		if (!state.used) {
+			image.firstStage = info.stage;
+			// an imported image waits only for its semaphore
+			transitions.push_back({i, VK_IMAGE_LAYOUT_UNDEFINED, info.layout,
+								   info.stage, 0, info.stage, info.access, !image.imported});
+		} else if (state.layout != info.layout || state.write || info.write) {
+			transitions.push_back({i, state.layout, info.layout, state.stage, state.access,
+								   info.stage, info.access, false});
+		}
+		state = {info.layout, info.stage, info.access, info.write, true};
+		image.lastStage = info.stage;
+		image.lastAccess = info.access;
+	};
+	for (uint32_t p = 0; p < passes.size(); p++) {
+		Pass &pass = passes[p];
+		pass.transitions.clear();
+		if (pass.culled) {
+			continue;
+		}
+		for (const auto &u : pass.uses) {
+			if (images[u.image].firstPass < 0) {
+				images[u.image].firstPass = p;
+			}
+			images[u.image].lastPass = p;
+			transition(u.image, u.access, pass.transitions);
+		}
+	}
+	finalTransitions.clear();
+	for (const auto &o : outputs) {
+		transition(o.image, o.access, finalTransitions);
+	}
+
+	// The render passes: the layouts are set by the barriers, the first
+	// pass of an image clears it, the last one does not store it
+	for (uint32_t p = 0; p < passes.size(); p++) {
+		Pass &pass = passes[p];
+		if (pass.culled || !pass.raster) {
+			continue;
+		}
+		std::vector<VkAttachmentDescription> attachments;
+		std::vector<VkAttachmentReference> colorRefs;
+		VkAttachmentReference depthRef{};
+		bool hasDepth = false;
+		pass.attachments.clear();
+		for (const auto &u : pass.uses) {
+			if (u.access != COLOR_ATTACHMENT && u.access != DEPTH_ATTACHMENT) {
+				continue;
+			}
+			const Image &image = images[u.image];
+			VkImageLayout layout = accessInfo(u.access).layout;
+			bool kept = image.imported || image.lastPass > static_cast<int>(p);
+
+			VkAttachmentDescription attachment{};
+			attachment.format = image.format;
+			attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+			attachment.loadOp = (image.firstPass == static_cast<int>(p)) ?
+								VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+			attachment.storeOp = kept ? VK_ATTACHMENT_STORE_OP_STORE :
+										VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachment.initialLayout = layout;
+			attachment.finalLayout = layout;
+
+			VkAttachmentReference ref{};
+			ref.attachment = static_cast<uint32_t>(attachments.size());
+			ref.layout = layout;
+			if (u.access == DEPTH_ATTACHMENT) {
+				depthRef = ref;
+				hasDepth = true;
+			} else {
+				colorRefs.push_back(ref);
+			}
+			attachments.push_back(attachment);
+			pass.attachments.push_back(u.image);
+		}
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+		subpass.pColorAttachments = colorRefs.data();
+		subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+
+		VkResult result = vkCreateRenderPass(BP->device, &renderPassInfo, nullptr,
+					&pass.renderPass);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create render pass!");
+		}
+	}
+}
+
+// The images that are not in use at the same time (in passes that do not
+// overlap) are placed in the same block of memory, largest first
+void RenderGraph::createImages(VkExtent2D extent) {
+	std::vector<uint32_t> order;
+	std::vector<VkMemoryRequirements> requirements(images.size());
+	for (uint32_t i = 0; i < images.size(); i++) {
+		Image &image = images[i];
+		if (image.imported || image.firstPass < 0) {
+			continue;
+		}
+		image.extent = extent;
+
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = extent.width;
+		imageInfo.extent.height = extent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = image.format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = image.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+		VkResult result = vkCreateImage(BP->device, &imageInfo, nullptr, &image.image);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+		 	throw std::runtime_error("failed to create image!");
+		}
+		vkGetImageMemoryRequirements(BP->device, image.image, &requirements[i]);
+		order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return requirements[a].size > requirements[b].size;
+	});
+
+	std::vector<std::vector<uint32_t>> blockImages;
+	std::vector<VkMemoryRequirements> blockRequirements;
+	for (uint32_t i : order) {
+		size_t b = 0;
+		for (; b < blockImages.size(); b++) {
+			if (!(blockRequirements[b].memoryTypeBits & requirements[i].memoryTypeBits)) {
+				continue;
+			}
+			bool overlaps = false;
+			for (uint32_t j : blockImages[b]) {
+				overlaps = overlaps || (images[i].firstPass <= images[j].lastPass &&
+										images[j].firstPass <= images[i].lastPass);
+			}
+			if (!overlaps) {
+				break;
+			}
+		}
+		if (b == blockImages.size()) {
+			blockImages.push_back({});
+			blockRequirements.push_back(requirements[i]);
+		} else {
+			VkMemoryRequirements &r = blockRequirements[b];
+			r.size = std::max(r.size, requirements[i].size);
+			r.alignment = std::max(r.alignment, requirements[i].alignment);
+			r.memoryTypeBits &= requirements[i].memoryTypeBits;
+		}
+		blockImages[b].push_back(i);
+		images[i].block = static_cast<uint32_t>(b);
+	}
+
+	VkDeviceSize total = 0;
+	VkDeviceSize aliased = 0;
+	blocks.resize(blockImages.size());
+	blockStages.assign(blockImages.size(), 0);
+	blockAccess.assign(blockImages.size(), 0);
+	for (size_t b = 0; b < blockImages.size(); b++) {
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = blockRequirements[b].size;
+		allocInfo.memoryTypeIndex = BP->findMemoryType(blockRequirements[b].memoryTypeBits,
+											VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		if (vkAllocateMemory(BP->device, &allocInfo, nullptr, &blocks[b]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate image memory!");
+		}
+		total += blockRequirements[b].size;
+
+		for (uint32_t i : blockImages[b]) {
+			Image &image = images[i];
+			vkBindImageMemory(BP->device, image.image, blocks[b], 0);
+			image.view = BP->createImageView(image.image, image.format,
+							isDepthFormat(image.format) ? VK_IMAGE_ASPECT_DEPTH_BIT :
+														  VK_IMAGE_ASPECT_COLOR_BIT, 1);
+			blockStages[b] |= image.lastStage;
+			blockAccess[b] |= image.lastAccess;
+			aliased += requirements[i].size;
+		}
+	}
+	aliased -= total;
+	std::cout << "Render graph: " << order.size() << " images in " << blocks.size() <<
+		" blocks, " << total / 1024 << " KB (" << aliased / 1024 << " KB shared)\n";
+}
+
+void RenderGraph::setImported(uint32_t image, VkImage handle, VkImageView view,
+							  VkExtent2D extent) {
+	images[image].image = handle;
+	images[image].view = view;
+	images[image].extent = extent;
+}
+
+void RenderGraph::recordTransitions(VkCommandBuffer commandBuffer,
+									const std::vector<Transition> &transitions) {
+	if (transitions.empty()) {
+		return;
+	}
+	std::vector<VkImageMemoryBarrier> barriers(transitions.size());
+	VkPipelineStageFlags srcStages = 0;
+	VkPipelineStageFlags dstStages = 0;
+	for (size_t i = 0; i < transitions.size(); i++) {
+		const Transition &t = transitions[i];
+		const Image &image = images[t.image];
+		VkPipelineStageFlags srcStage = t.srcStage;
+		VkAccessFlags srcAccess = t.srcAccess;
+		if (t.firstUse) {
+			srcStage = blockStages[image.block];
+			srcAccess = blockAccess[image.block];
+		}
+
+		VkImageMemoryBarrier &barrier = barriers[i];
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = t.oldLayout;
+		barrier.newLayout = t.newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image.image;
+		barrier.subresourceRange.aspectMask = isDepthFormat(image.format) ?
+						VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = t.dstAccess;
+		srcStages |= srcStage;
+		dstStages |= t.dstStage;
+	}
+	vkCmdPipelineBarrier(commandBuffer,
+						 srcStages ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+						 dstStages, 0, 0, nullptr, 0, nullptr,
+						 static_cast<uint32_t>(barriers.size()), barriers.data());
+}
+
+// One framebuffer per view of the imported attachment, as the swap chain
+// images change from frame to frame
+VkFramebuffer RenderGraph::framebuffer(uint32_t p) {
+	Pass &pass = passes[p];
+	std::vector<VkImageView> views;
+	VkImageView key = VK_NULL_HANDLE;
+	VkExtent2D extent{};
+	for (uint32_t i : pass.attachments) {
+		views.push_back(images[i].view);
+		extent = images[i].extent;
+		if (images[i].imported) {
+			key = images[i].view;
+		}
+	}
+	auto it = pass.framebuffers.find(key);
+	if (it != pass.framebuffers.end()) {
+		return it->second;
+	}
+
+	VkFramebufferCreateInfo framebufferInfo{};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = pass.renderPass;
+	framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+	framebufferInfo.pAttachments = views.data();
+	framebufferInfo.width = extent.width;
+	framebufferInfo.height = extent.height;
+	framebufferInfo.layers = 1;
+
+	VkFramebuffer framebuffer;
+	VkResult result = vkCreateFramebuffer(BP->device, &framebufferInfo, nullptr,
+				&framebuffer);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create framebuffer!");
+	}
+	pass.framebuffers[key] = framebuffer;
+	return framebuffer;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t frame) {
+	for (uint32_t p = 0; p < passes.size(); p++) {
+		Pass &pass = passes[p];
+		if (pass.culled) {
+			continue;
+		}
+		recordTransitions(commandBuffer, pass.transitions);
+		if (!pass.raster) {
+			pass.record(commandBuffer, frame);
+			continue;
+		}
+
+		pass.currentFramebuffer = framebuffer(p);
+		std::vector<VkClearValue> clearValues(pass.attachments.size());
+		for (size_t a = 0; a < pass.attachments.size(); a++) {
+			if (isDepthFormat(images[pass.attachments[a]].format)) {
+				clearValues[a].depthStencil = {1.0f, 0};
+			} else {
+				clearValues[a].color = BP->initialBackgroundColor;
+			}
+		}
+
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = pass.renderPass;
+		renderPassInfo.framebuffer = pass.currentFramebuffer;
+		renderPassInfo.renderArea.offset = {0, 0};
+		renderPassInfo.renderArea.extent = pass.area ? *pass.area :
+										   images[pass.attachments[0]].extent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, pass.secondary ?
+							 VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS :
+							 VK_SUBPASS_CONTENTS_INLINE);
+		pass.record(commandBuffer, frame);
+		vkCmdEndRenderPass(commandBuffer);
+	}
+	recordTransitions(commandBuffer, finalTransitions);
+}
+
+// Destroys the images and framebuffers of the current size, even after they
+// have been replaced by createImages
+std::function<void()> RenderGraph::resourceDestroyer() {
+	VkDevice device = BP->device;
+	std::vector<VkImage> oldImages;
+	std::vector<VkImageView> oldViews;
+	std::vector<VkFramebuffer> oldFramebuffers;
+	std::vector<VkDeviceMemory> oldBlocks = blocks;
+	for (auto &image : images) {
+		if (!image.imported && image.image != VK_NULL_HANDLE) {
+			oldImages.push_back(image.image);
+			oldViews.push_back(image.view);
+			image.image = VK_NULL_HANDLE;
+			image.view = VK_NULL_HANDLE;
+		}
+	}
+	for (auto &pass : passes) {
+		for (auto &f : pass.framebuffers) {
+			oldFramebuffers.push_back(f.second);
+		}
+		pass.framebuffers.clear();
+	}
+	blocks.clear();
+
+	return [=]() {
+		for (auto framebuffer : oldFramebuffers) {
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		}
+		for (size_t i = 0; i < oldImages.size(); i++) {
+			vkDestroyImageView(device, oldViews[i], nullptr);
+			vkDestroyImage(device, oldImages[i], nullptr);
+		}
+		for (auto memory : oldBlocks) {
+			vkFreeMemory(device, memory, nullptr);
+		}
+	};
+}
+
+void RenderGraph::cleanup() {
+	for (auto &pass : passes) {
+		if (pass.renderPass != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(BP->device, pass.renderPass, nullptr);
+		}
+	}
+}
+
+VkVertexInputBindingDescription SpriteVertex::getBindingDescription() {
+	VkVertexInputBindingDescription bindingDescription{};
+	bindingDescription.binding = 0;
+	bindingDescription.stride = sizeof(SpriteVertex);
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	return bindingDescription;
+}
+
+std::vector<VkVertexInputAttributeDescription> SpriteVertex::getAttributeDescriptions() {
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(3);
+	attributeDescriptions[0] = {0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(SpriteVertex, pos)};
+	attributeDescriptions[1] = {1, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(SpriteVertex, texCoord)};
+	attributeDescriptions[2] = {2, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(SpriteVertex, color)};
+	return attributeDescriptions;
+}
+
+// The textures of the sprites are in set 0, with the layout textureLayout;
+// the projection is a push constant
+void SpriteBatch::init(BaseProject *bp, uint32_t spriteCount, const std::string& VertShader,
+					   const std::string& FragShader, DescriptorSetLayout *textureLayout) {
+	BP = bp;
+	maxSprites = spriteCount;
+
+	VkDeviceSize size = maxSprites * 6 * sizeof(SpriteVertex);
+	buffers.resize(MAX_FRAMES_IN_FLIGHT);
+	buffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	mapped.resize(MAX_FRAMES_IN_FLIGHT);
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		BP->createBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 buffers[i], buffersMemory[i]);
+		// written every frame: mapped once
+		vkMapMemory(BP->device, buffersMemory[i], 0, size, 0, &mapped[i]);
+	}
+
+	PipelineState state;
+	state.renderPass = BP->overlayRenderPass;
+	state.binding = SpriteVertex::getBindingDescription();
+	state.attributes = SpriteVertex::getAttributeDescriptions();
+	state.depthTest = false;
+	state.alphaBlend = true;
+	state.cullMode = VK_CULL_MODE_NONE;
+	pipeline.init(BP, VertShader, FragShader, {textureLayout},
+				  {{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4)}}, state);
+}
+
+void SpriteBatch::begin() {
+	sprites.clear();
+}
+
+// pos and size in pixels; the sprites after the first maxSprites are dropped
+void SpriteBatch::add(DescriptorSet &texture, glm::vec2 pos, glm::vec2 size, int layer,
+					  glm::vec4 texRect, glm::vec4 color) {
+	if (sprites.size() < maxSprites) {
+		sprites.push_back({&texture, layer, pos, size, texRect, color});
+	}
+}
+
+// All the glyphs share the atlas: in a layer, a text is a single draw
+void SpriteBatch::addText(const TextLayout &text, glm::vec2 pos, int layer,
+						  glm::vec4 color) {
+	for (const auto &quad : text.quads) {
+		add(text.font->ds, pos + quad.pos, quad.size, layer, quad.texRect, color);
+	}
+}
+
+void SpriteBatch::upload(uint32_t frame) {
+	// the order of the sprites is kept in a layer and texture
+	std::stable_sort(sprites.begin(), sprites.end(), [](const Sprite &a, const Sprite &b) {
+		return a.layer != b.layer ? a.layer < b.layer : a.texture < b.texture;
+	});
+
+	batches.clear();
+	SpriteVertex *vertex = static_cast<SpriteVertex *>(mapped[frame]);
+	uint32_t vertexCount = 0;
+	for (const auto &sprite : sprites) {
+		if (batches.empty() || batches.back().texture != sprite.texture) {
+			batches.push_back({sprite.texture, vertexCount, 0});
+		}
+		glm::vec2 p0 = sprite.pos;
+		glm::vec2 p1 = sprite.pos + sprite.size;
+		glm::vec2 t0(sprite.texRect.x, sprite.texRect.y);
+		glm::vec2 t1(sprite.texRect.z, sprite.texRect.w);
+		const SpriteVertex corners[6] = {
+			{p0, t0, sprite.color},
+			{{p1.x, p0.y}, {t1.x, t0.y}, sprite.color},
+			{p1, t1, sprite.color},
+			{p0, t0, sprite.color},
+			{p1, t1, sprite.color},
+			{{p0.x, p1.y}, {t0.x, t1.y}, sprite.color}
+		};
+		memcpy(vertex, corners, sizeof(corners));
+		vertex += 6;
+		vertexCount += 6;
+		batches.back().vertexCount += 6;
+	}
+	BP->frameStats.uploadBytes += vertexCount * sizeof(SpriteVertex);
+}
+
+// In the overlay render pass: the viewport is the whole swap chain image
+void SpriteBatch::record(VkCommandBuffer commandBuffer, uint32_t frame) {
+	if (batches.empty()) {
+		return;
+	}
+	VkExtent2D extent = BP->swapChainExtent;
+	VkViewport viewport{};
+	viewport.width = (float) extent.width;
+	viewport.height = (float) extent.height;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	VkRect2D scissor{};
+	scissor.extent = extent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+					  pipeline.graphicsPipeline);
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &buffers[frame], &offset);
+	// y down, as the pixels
+	glm::mat4 proj = glm::ortho(0.0f, viewport.width, 0.0f, viewport.height);
+	vkCmdPushConstants(commandBuffer, pipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+					   0, sizeof(proj), &proj);
+	for (const auto &batch : batches) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+								pipeline.pipelineLayout, 0, 1,
+								&batch.texture->descriptorSets[frame], 0, nullptr);
+		vkCmdDraw(commandBuffer, batch.vertexCount, 1, batch.firstVertex, 0);
+	}
+	BP->drawCalls += static_cast<uint32_t>(batches.size());
+}
+
+void SpriteBatch::cleanup() {
+	for (size_t i = 0; i < buffers.size(); i++) {
+		vkUnmapMemory(BP->device, buffersMemory[i]);
+		vkDestroyBuffer(BP->device, buffers[i], nullptr);
+		vkFreeMemory(BP->device, buffersMemory[i], nullptr);
+	}
+	pipeline.cleanup();
+}
+
+// The rows of the glyphs, top to bottom: bit 4 is the leftmost pixel
+static const struct {
+	char c;
+	uint8_t rows[Font::GLYPH_HEIGHT];
+} FONT_GLYPHS[] = {
+	{' ', {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}},
+	{'!', {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}},
+	{'%', {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}},
+	{'\'', {0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}},
+	{'(', {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}},
+	{')', {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}},
+	{'+', {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}},
+	{',', {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}},
+	{'-', {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}},
+	{'.', {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}},
+	{'/', {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}},
+	{'0', {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}},
+	{'1', {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}},
+	{'2', {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}},
+	{'3', {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}},
+	{'4', {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}},
+	{'5', {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}},
+	{'6', {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}},
+	{'7', {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}},
+	{'8', {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}},
+	{'9', {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}},
+	{':', {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}},
+	{'=', {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}},
+	{'?', {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}},
+	{'A', {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11}},
+	{'B', {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}},
+	{'C', {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}},
+	{'D', {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}},
+	{'E', {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}},
+	{'F', {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}},
+	{'G', {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}},
+	{'H', {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}},
+	{'I', {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}},
+	{'J', {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}},
+	{'K', {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}},
+	{'L', {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}},
+	{'M', {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}},
+	{'N', {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}},
+	{'O', {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}},
+	{'P', {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}},
+	{'Q', {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}},
+	{'R', {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}},
+	{'S', {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}},
+	{'T', {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}},
+	{'U', {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}},
+	{'V', {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}},
+	{'W', {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}},
+	{'X', {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}},
+	{'Y', {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}},
+	{'Z', {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}},
+	{'_', {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}},
+};
+
+void Font::init(BaseProject *bp, DescriptorSetLayout *textureLayout) {
+	const int columns = 16;
+	const uint32_t width = columns * CELL_WIDTH;
+	const uint32_t height = (128 / columns) * CELL_HEIGHT;
+	std::vector<unsigned char> pixels(width * height * 4, 0);
+
+	for (int c = 0; c < 128; c++) {
+		// the top-left pixel of the glyph, inside the border of its cell
+		uint32_t x0 = (c % columns) * CELL_WIDTH + 1;
+		uint32_t y0 = (c / columns) * CELL_HEIGHT + 1;
+		texRects[c] = glm::vec4(x0 / (float) width, y0 / (float) height,
+								(x0 + GLYPH_WIDTH) / (float) width,
+								(y0 + GLYPH_HEIGHT) / (float) height);
+	}
+	for (const auto &glyph : FONT_GLYPHS) {
+		uint32_t x0 = (glyph.c % columns) * CELL_WIDTH + 1;
+		uint32_t y0 = (glyph.c / columns) * CELL_HEIGHT + 1;
+		for (int y = 0; y < GLYPH_HEIGHT; y++) {
+			for (int x = 0; x < GLYPH_WIDTH; x++) {
+				if (glyph.rows[y] & (1 << (GLYPH_WIDTH - 1 - x))) {
+					unsigned char *pixel = &pixels[((y0 + y) * width + x0 + x) * 4];
+					pixel[0] = pixel[1] = pixel[2] = pixel[3] = 255;
+				}
+			}
+		}
+	}
+
+	const int solid = 127;
+	for (int y = 0; y < GLYPH_HEIGHT; y++) {
+		for (int x = 0; x < GLYPH_WIDTH; x++) {
+			uint32_t px = (solid % columns) * CELL_WIDTH + 1 + x;
+			uint32_t py = (solid / columns) * CELL_HEIGHT + 1 + y;
+			memset(&pixels[(py * width + px) * 4], 255, 4);
+		}
+	}
+	solidRect = texRects[solid];
+
+	atlas.filter = VK_FILTER_NEAREST;
+	atlas.mipmaps = false;
+	atlas.init(bp, pixels, width, height);
+	ds.init(bp, textureLayout, {
+				{1, TEXTURE, 0, &atlas}
+		});
+}
+
+void Font::cleanup() {
+	ds.cleanup();
+	atlas.cleanup();
+}
+
+// One glyph every GLYPH_WIDTH + 1 pixels of the font, and a line every
+// GLYPH_HEIGHT + 2, scaled to the height
+void TextLayout::set(Font &f, const std::string &t, float h) {
+	if (font == &f && text == t && height == h) {
+		return;
+	}
+	font = &f;
+	text = t;
+	height = h;
+	quads.clear();
+
+	float scale = h / Font::GLYPH_HEIGHT;
+	glm::vec2 glyphSize(Font::GLYPH_WIDTH * scale, h);
+	glm::vec2 pen(0.0f);
+	size = glm::vec2(0.0f, text.empty() ? 0.0f : h);
+	for (char ch : text) {
+		if (ch == '\n') {
+			pen = glm::vec2(0.0f, pen.y + (Font::GLYPH_HEIGHT + 2) * scale);
+			size.y = pen.y + h;
+			continue;
+		}
+		unsigned char c = static_cast<unsigned char>(std::toupper(static_cast<unsigned char>(ch)));
+		if (c != ' ' && c < 128) {
+			quads.push_back({pen, glyphSize, font->texRects[c]});
+		}
+		size.x = std::max(size.x, pen.x + glyphSize.x);
+		pen.x += (Font::GLYPH_WIDTH + 1) * scale;
+	}
+}
+
+void PerfOverlay::init(BaseProject *bp, const std::string& VertShader,
+					   const std::string& FragShader) {
+	BP = bp;
+	textureLayout.init(BP, {
+		{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
+	});
+	font.init(BP, &textureLayout);
+	batch.init(BP, MAX_SPRITES, VertShader, FragShader, &textureLayout);
+}
+
+// Called with the counters of each frame, once it has been recorded
+void PerfOverlay::addFrame(const FrameStats &stats) {
+	last = stats;
+	frameTimes[historyEnd] = stats.frameTime;
+	historyEnd = (historyEnd + 1) % HISTORY;
+}
+
+std::string PerfOverlay::heapText() {
+	// the budget needs the Vulkan 1.1 query, the sizes alone don't
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+	budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	VkPhysicalDeviceMemoryProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	if (BP->memoryBudgetSupported) {
+		properties.pNext = &budget;
+		vkGetPhysicalDeviceMemoryProperties2(BP->physicalDevice, &properties);
+	} else {
+		vkGetPhysicalDeviceMemoryProperties(BP->physicalDevice,
+											&properties.memoryProperties);
+	}
+
+	std::string heaps;
+	const VkPhysicalDeviceMemoryProperties &memory = properties.memoryProperties;
+	for (uint32_t h = 0; h < memory.memoryHeapCount; h++) {
+		const float MB = 1024.0f * 1024.0f;
+		char line[64];
+		const char *kind = (memory.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ?
+						   "DEVICE" : "HOST";
+		if (BP->memoryBudgetSupported) {
+			snprintf(line, sizeof(line), "\nHEAP %u %-6s %6.0f/%.0f MB", h, kind,
+					 budget.heapUsage[h] / MB, budget.heapBudget[h] / MB);
+		} else {
+			snprintf(line, sizeof(line), "\nHEAP %u %-6s %6.0f MB", h, kind,
+					 memory.memoryHeaps[h].size / MB);
+		}
+		heaps += line;
+	}
+	return heaps;
+}
+
+// In the bottom-left corner: the panel, the graph (a bar per frame, up to
+// twice the budget of 60 FPS) and the text, in this order in one batch
+void PerfOverlay::update(uint32_t frame) {
+	batch.begin();
+	if (!visible) {
+		batch.upload(frame);
+		return;
+	}
+
+	float frameAverage = 0.0f;
+	float frameMax = 0.0f;
+	for (float t : frameTimes) {
+		frameAverage += t / HISTORY;
+		frameMax = std::max(frameMax, t);
+	}
+	double now = glfwGetTime();
+	if (now - lastTextUpdate >= textPeriod || text.font == nullptr) {
+		lastTextUpdate = now;
+		char counters[512];
+		snprintf(counters, sizeof(counters),
+				 "FRAME %6.2f MS  AVG %6.2f  MAX %6.2f\n"
+				 "CPU   %6.2f MS  RECORD %6.3f MS\n"
+				 "%s %6.2f MS\n"
+				 "GPU   %6.2f MS  SCALE %3d%%\n"
+				 "DRAW CALLS %u  VISIBLE %u/%u\n"
+				 "BINDS %u  AVOIDED %u\n"
+				 "UPLOADS %.1f KB  %u WRITTEN  %u SKIPPED",
+				 last.frameTime, frameAverage, frameMax,
+				 last.inputToSubmit, last.recordTime,
+				 BP->presentWaitSupported ? "PRESENT" : "GPU DONE (FALLBACK)",
+				 BP->presentWaitSupported ? last.submitToPresent : last.submitToGpuComplete,
+				 last.gpuTime, static_cast<int>(last.renderScale * 100.0f + 0.5f),
+				 last.drawCalls, last.drawsVisible, last.drawsTotal,
+				 last.bindsIssued, last.bindsAvoided,
+				 last.uploadBytes / 1024.0f, last.uploadsWritten, last.uploadsSkipped);
+		text.set(font, counters + heapText(), 2.0f * Font::GLYPH_HEIGHT);
+	}
+
+	const float pixel = 2.0f;
+	const float padding = 4.0f * pixel;
+	const float graphHeight = 40.0f * pixel;
+	const float budget = 1000.0f / 60.0f;	// ms
+	const glm::vec4 background(0.0f, 0.0f, 0.0f, 0.6f);
+	glm::vec2 panel(std::max(text.size.x, HISTORY * pixel) + 2.0f * padding,
+					text.size.y + graphHeight + 3.0f * padding);
+	glm::vec2 corner(padding, BP->swapChainExtent.height - panel.y - padding);
+	batch.add(font.ds, corner, panel, 0, font.solidRect, background);
+
+	glm::vec2 graph = corner + glm::vec2(padding, padding);
+	for (int i = 0; i < HISTORY; i++) {
+		float t = frameTimes[(historyEnd + i) % HISTORY];
+		float h = std::min(t / (2.0f * budget), 1.0f) * graphHeight;
+		glm::vec4 color = t <= budget ? glm::vec4(0.2f, 0.9f, 0.2f, 1.0f) :
+						  t <= 2.0f * budget ? glm::vec4(0.9f, 0.8f, 0.2f, 1.0f) :
+											   glm::vec4(0.9f, 0.2f, 0.2f, 1.0f);
+		batch.add(font.ds, graph + glm::vec2(i * pixel, graphHeight - h),
+				  glm::vec2(pixel, h), 0, font.solidRect, color);
+	}
+	batch.add(font.ds, graph + glm::vec2(0.0f, graphHeight / 2.0f),
+			  glm::vec2(HISTORY * pixel, 1.0f), 0, font.solidRect, glm::vec4(1.0f, 1.0f, 1.0f, 0.5f));
+
+	batch.addText(text, graph + glm::vec2(0.0f, graphHeight + padding));
+	batch.upload(frame);
+}
+
+void PerfOverlay::record(VkCommandBuffer commandBuffer, uint32_t frame) {
+	batch.record(commandBuffer, frame);
+}
+
+void PerfOverlay::cleanup() {
+	batch.cleanup();
+	font.cleanup();
+	textureLayout.cleanup();
 }
\ No newline at end of file
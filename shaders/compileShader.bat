@@ -1,3 +1,9 @@
 C:\VulkanSDK\1.3.204.0\Bin\glslc.exe shader.frag -o frag.spv
 C:\VulkanSDK\1.3.204.0\Bin\glslc.exe shader.vert -o vert.spv
+C:\VulkanSDK\1.3.204.0\Bin\glslc.exe shaderPC.vert -o vertPC.spv
+C:\VulkanSDK\1.3.204.0\Bin\glslc.exe shaderInst.vert -o vertInst.spv
+C:\VulkanSDK\1.3.204.0\Bin\glslc.exe shaderBindless.frag -o fragBindless.spv
+C:\VulkanSDK\1.3.204.0\Bin\glslc.exe cull.comp -o cull.spv
+C:\VulkanSDK\1.3.204.0\Bin\glslc.exe shaderSprite.vert -o vertSprite.spv
+C:\VulkanSDK\1.3.204.0\Bin\glslc.exe shaderSprite.frag -o fragSprite.spv
 pause
\ No newline at end of file
@@ -0,0 +1,32 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// The bindless texture table, indexed by the texIndex of the draw or instance
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+layout(location = 0) in vec3 fragViewDir;
+layout(location = 1) in vec3 fragNorm;
+layout(location = 2) in vec2 fragTexCoord;
+layout(location = 3) flat in uint fragTexIndex;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	const vec3  diffColor = texture(textures[nonuniformEXT(fragTexIndex)], fragTexCoord).rgb;
+	const vec3  specColor = vec3(1.0f, 1.0f, 1.0f);
+	const float specPower = 150.0f;
+	const vec3  L = vec3(-0.4830f, 0.8365f, -0.2588f);
+	
+	vec3 N = normalize(fragNorm);
+	vec3 R = -reflect(L, N);
+	vec3 V = normalize(fragViewDir);
+	
+	// Lambert diffuse
+	vec3 diffuse  = diffColor * max(dot(N,L), 0.0f);
+	// Phong specular
+	vec3 specular = specColor * pow(max(dot(R,V), 0.0f), specPower);
+	// Hemispheric ambient
+	vec3 ambient  = (vec3(0.1f,0.1f, 0.1f) * (1.0f + N.y) + vec3(0.0f,0.0f, 0.1f) * (1.0f - N.y)) * diffColor;
+	
+	outColor = vec4(clamp(ambient + diffuse + specular, vec3(0.0f), vec3(1.0f)), 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 view;
+	mat4 proj;
+} gubo;
+
+struct InstanceObject {
+	mat4 model;
+	uint texIndex;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer InstanceBufferObject {
+	InstanceObject data[];
+} instances;
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 norm;
+layout(location = 2) in vec2 texCoord;
+
+layout(location = 0) out vec3 fragViewDir;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 fragTexCoord;
+layout(location = 3) flat out uint fragTexIndex;
+
+void main() {
+	mat4 model = instances.data[gl_InstanceIndex].model;
+	gl_Position = gubo.proj * gubo.view * model * vec4(pos, 1.0);
+	fragViewDir  = (gubo.view[3]).xyz - (model * vec4(pos,  1.0)).xyz;
+	fragNorm     = (model * vec4(norm, 0.0)).xyz;
+	fragTexCoord = texCoord;
+	fragTexIndex = instances.data[gl_InstanceIndex].texIndex;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 view;
+	mat4 proj;
+} gubo;
+
+layout(push_constant) uniform PushConstantObject {
+	mat4 model;
+	uint texIndex;
+} pco;
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 norm;
+layout(location = 2) in vec2 texCoord;
+
+layout(location = 0) out vec3 fragViewDir;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 fragTexCoord;
+layout(location = 3) flat out uint fragTexIndex;
+
+void main() {
+	gl_Position = gubo.proj * gubo.view * pco.model * vec4(pos, 1.0);
+	fragViewDir  = (gubo.view[3]).xyz - (pco.model * vec4(pos,  1.0)).xyz;
+	fragNorm     = (pco.model * vec4(norm, 0.0)).xyz;
+	fragTexCoord = texCoord;
+	fragTexIndex = pco.texIndex;
+}
\ No newline at end of file
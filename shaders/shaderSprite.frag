@@ -0,0 +1,13 @@
+#version 450
+
+// Unlit: the texture tinted by the color of the sprite, blended over the frame
+layout(set = 0, binding = 1) uniform sampler2D texSampler;
+
+layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) in vec4 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	outColor = texture(texSampler, fragTexCoord) * fragColor;
+}
\ No newline at end of file
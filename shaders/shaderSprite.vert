@@ -0,0 +1,20 @@
+#version 450
+
+// The 2D overlay: pos in pixels, projected by the orthographic matrix of
+// the swap chain image
+layout(push_constant) uniform SpritePushConstant {
+	mat4 proj;
+} pc;
+
+layout(location = 0) in vec2 pos;
+layout(location = 1) in vec2 texCoord;
+layout(location = 2) in vec4 color;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+	gl_Position = pc.proj * vec4(pos, 0.0, 1.0);
+	fragTexCoord = texCoord;
+	fragColor = color;
+}
\ No newline at end of file